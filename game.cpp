@@ -6,28 +6,60 @@
  *          enter - advance f - use short range wep (which is #)
  *          q - quit        u - shoot up with long range wep (which is !)
  *          h - shoot left  j - shoot below
- *          k - shoot right 
+ *          k - shoot right r - reload
+ *          b - rewind one tick
  * Output: Grid with players, obstacles, weapons, and storm
  *          Note -  In my version, the storm immediately destroyes obstacles and weapons (since they're much weaker)
- *                  but gives all of the players 2 ticks before destroying htem
+ *                  but players standing in it lose hp every tick, faster the deeper in they are
  *                  Also, the short range weapon requires 2 shots to destory, 
  *                  and long range requires 1 shot to destory
+ *                  Weapons come with limited rounds, an empty magazine reloads by itself
  *                  There are 3 long range weapons and 5 short range weapons that spawn
  */
 
 #include <iostream>
+#include <fstream>
 #include <ncurses.h>
 #include <stdlib.h>
 #include <time.h>
 #include <cmath>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#ifdef __cpp_impl_coroutine
+#include <coroutine>                // scripted NPCs, only with -std=c++20
+#endif
 
 using namespace std;
 
 #define curses
 #define SAVELASTROUND true // if we want to save the last round set to true so it doesn't get autoerased
 
-int GRIDX = 50;
+int GRIDX = 50;     // size from the command line, only read when a match is created
 int GRIDY = 14;
 
 const int X = 0;
@@ -40,9 +72,18 @@ const int INT_TO_UPPER_ALPH = 65;   // num to add to 0 to make it represent 'A'
 const bool ALIVE = true;
 const bool DEAD = false;
 const int ROUNDCOUNT = 100;
+const int TICK_MS = 100;            // length of a timed tick (server and hosted matches)
+const int INPUT_POLL_MS = 5;        // how often the local game looks at the input ring while it's empty
+const int RENDER_POLL_MS = 5;       // same for the render thread waiting on a new frame
+const int STORM_TICKS = 30;         // ticks per storm round, enter skips straight to the next round
+const int STORM_GRACE_TICKS = 2 * STORM_TICKS;  // a stormed cell with a player on it is retried this often
+const int RELOAD_TICKS = 5;
+const int LONG_COOLDOWN_TICKS = 5;  // between two long range shots
+const int WEAPON_RESPAWN_TICKS = 3 * STORM_TICKS;   // a picked up weapon comes back after 3 rounds
 
 // uncomment when obstacles are needed
 const int NUM_OF_OBSTACLES = 20; // declaring number of obstacles
+const int FOV_RADIUS = 8;        // how many cells a player can see in any direction
 
 /*
  * class_identifier: abstract class with virtual move functions and methods to set and get speed
@@ -86,50 +127,37 @@ private:
 };
 
 /*
- * class_identifier: initializes, prints, randomizes coordinates - both current and old x and y
+ * class_identifier: initializes, prints, randomizes coordinates
+ *                   movers remember where they came from themselves (see updatePos), which keeps this 8 bytes
  * constructors: coord_t()
  *               coord_t(int usrx, int usry)
- * public functions:    int getOldx() const
- *                      int getOldy() const
- *                      void setOldx(int usrOldx)
- *                      void setOldy(int usrOldy)
- *                      void print() const
- *                      void randomize()
+ * public functions:    void print() const
+ *                      void randomize(int cols, int rows, unsigned int& seed)
+ *                      void rando(int cols, int rows, unsigned int& seed)
  * static members: none
  */
 
 class coord_t {
 public:
     coord_t();
-    coord_t(int usrx, int usry); // initializes x and oldx to usr x; same w/ y
-    int getOldx() const {return oldx;}
-    int getOldy() const {return oldy;}
-    void rando();
-    void setOldx(int usrOldx) {oldx = usrOldx;}
-    void setOldy(int usrOldy) {oldy = usrOldy;}
+    coord_t(int usrx, int usry); // initializes x and y to usr values
+    void rando(int cols, int rows, unsigned int& seed);
     void print() const;
-    void randomize();
+    void randomize(int cols, int rows, unsigned int& seed);
 public:
     int x;
     int y;
-private:
-    int oldx;
-    int oldy;
 };
 
 // default constructor, setting vars to 0
 coord_t::coord_t() {
-    x = y = oldx = oldy = 0;
+    x = y = 0;
 }
 
 // constructor setting x and y to usr defined values, assuming they are appropriate
 coord_t::coord_t(int usrx, int usry) {
-    if (usrx <= GRIDX && usry <= GRIDY) {
-        x = usrx;
-        oldx = usrx;
-        y = usry;
-        oldy = usry;
-    }
+    x = usrx;
+    y = usry;
 }
 // prints coordinates
 void coord_t::print() const {
@@ -142,28 +170,27 @@ void coord_t::print() const {
 
 /*
  * function_identifier: assingns x and y to random positons within coord system
- * parameters: none
+ * parameters: grid size, the match's random state (so every match rolls its own numbers)
  * return value: none
  */
-void coord_t::randomize() {
-    oldx = x;
-    oldy = y;
-    
-    x = rand() % GRIDX;    // mod operator to ensure x and y are within coord system
-    y = rand() % GRIDY;
+void coord_t::randomize(int cols, int rows, unsigned int& seed) {
+    x = rand_r(&seed) % cols;    // mod operator to ensure x and y are within coord system
+    y = rand_r(&seed) % rows;
 }
 
-void coord_t::rando() {
-    oldx = x;
-    oldy = y;
-
-    x = rand() % GRIDX;
-    while (x <= GRIDX/2) x++; // ensures center is in the second half of grid
-    y = rand() % GRIDY;
+void coord_t::rando(int cols, int rows, unsigned int& seed) {
+    x = rand_r(&seed) % cols;
+    while (x <= cols/2) x++; // ensures center is in the second half of grid
+    y = rand_r(&seed) % rows;
 }
 /*
  * class_identifier: declares and manipulates status, id, creationtime of all entities
  *                   this class is inherited by others frequently
+ *                   an entity a world_t holds is a handle: its position, hp and glyph live in the
+ *                   world's component columns at (archetype, row). entities outside any world
+ *                   (the map as storm cell, the blank) only have their own glyph and status.
+ *                   id, creation time and the names/types/infos of the derived classes are a cold
+ *                   column of the same world that only printing goes through
  * constructors: ent_t()
  * public functions:    int getId() const
  *                      bool getStat() const
@@ -171,32 +198,49 @@ void coord_t::rando() {
  *                      void setStat(bool usrStat)
  *                      void entprint()
  *                      void printCreationTime()
- * static members: entCnt
+ *                      coord_t& pos()
+ *                      health_t& hp()
+ *                      char& glyph()
+ *                      world_t* getWorld() const
+ *                      int getArch() const
+ *                      int getRow() const
+ * static members: none
  */
 
+class world_t;
+
 class ent_t {
 public:
     virtual char cprint();   // creating a virtual print function
     ent_t() {createEntity();}
-    int getId() const {return id;}
+    virtual ~ent_t() {}
+    int getId() const;          // 0 outside a world
     bool getStat() const {return status;}
-    void setId(int usrId) {id = usrId;}
+    void setId(int usrId);
     void setStat(bool usrStat) {status = usrStat;}
     void entprint() const;
     void printCreationTime() const;
-    coord_t pos;
-    health_t hp;
-    char symbol;
+    coord_t& pos();             // only for entities a world holds
+    const coord_t& pos() const;
+    health_t& hp();             // ditto
+    char& glyph();              // the world's glyph column, or symbol outside a world
+    world_t* getWorld() const {return world;}
+    int getArch() const {return arch;}
+    int getRow() const {return row;}
 private:
+    friend class world_t;       // add() hands out the row
     void createEntity();
+    world_t* world;
+    int row;
+public:
+    char symbol;
+private:
+    signed char arch;
 protected:
-    
+    string getLabel() const;            // name/type/info of the derived class, "" if never set
+    void setLabel(const string& label); // ignored outside a world
 private:
-    int id;
-    time_t creationTime;
     bool status;
-    static int entCnt;
-    
 };
 
 char ent_t::cprint() {
@@ -204,55 +248,19 @@ char ent_t::cprint() {
     return ' ';
 }
 
-
-/*
- * function_identifier: prints entity's infomation in both ncurses and not
- * parameters: none
- * return value: none
- */
-void ent_t::entprint() const {
-#ifdef curses
-    printw("Entity: %i/%i\nStatus: %i\nCreated: ", id, entCnt, status);
-    printCreationTime();
-#else
-    cout << "Entity: " << id << "/" << entCnt << endl << "Status: ";
-    if (status == 1) cout << "Alive";
-    else if (status == 0) cout << "Dead";
-    else cout << "undefined";
-    cout << endl << "Created: ";
-    printCreationTime();
-#endif
-}
-
-// prints creation time in both ncurses and not
-void ent_t::printCreationTime() const {
-#ifdef curses
-    printw("%s", ctime(&creationTime));
-#else
-    cout << ctime(&creationTime);
-#endif
-}
-
 /*
  * function_identifier: initializes entity values, used for constructor
  * parameters: none
  * return value: none
  */
 void ent_t::createEntity() {
-    id = ++entCnt;
-    entCnt += 1;
-    creationTime = time(NULL); // current time
+    symbol = ' ';
     status = ALIVE;
+    world = nullptr;
+    row = -1;
+    arch = -1;
 }
 
-int ent_t::entCnt = 0;
-
-// used in part II
-class world_t {
-private:
-    ent_t *ent;
-};
-
 /*
  * class_identifier: sets type for obstacle and prints obstacle info
  * constructors: none
@@ -264,18 +272,16 @@ private:
 
 class obstacle_t : public ent_t {
 public:
-    string getId() const {return id;} // id getter
-    void setType(string usrType) {id = usrType;} // id setter
+    obstacle_t() {symbol = '@';}
+    string getId() const {return getLabel();}               // id getter
+    void setType(string usrType) {setLabel(usrType);}       // id setter, kept with the cold entity data
     void printObstacle() const;
     char cprint ();
-    health_t hp;
-private:
-    string id;
 };
 
 char obstacle_t::cprint() {
     // printw("%c", '@');      //  printing the obstacle
-    return '@';
+    return glyph();
 }
 
 /*
@@ -293,39 +299,61 @@ char obstacle_t::cprint() {
  *                      void setMagCap(int usrMC)
  *                      void setMagAmmo(int usrMA)
  *                      void reload()
+ *                      void finishReload()
  *                      bool isReloading()
  *                      void print()
- * static members: pCnt
+ *                   a weapon is carried by a player, never placed on the grid, so it isn't an ent_t
+ *                   the counters are shorts and the model is an index into a shared name table,
+ *                   which keeps the whole weapon at 10 bytes inside player_t
+ * static members: models, modelLock
  */
 
-class weapon_t : public ent_t {
+class weapon_t {
 public:
     weapon_t();
     weapon_t(int, int, int, int, string);
     int getAmmo() const {return ammo;}
     int getDmg() const {return dmg;}
-    string getModel() const {return model;}
+    string getModel() const;
     int getMagCap() const {return magcap;}
     int getMagAmmo() const {return magammo;}
     void setAmmo(int usrAmmo) {ammo = usrAmmo;}
     void setDmg(int usrDmg) {dmg = usrDmg;}
-    void setModel(string usrModel) {model = usrModel;}
+    void setModel(string usrModel);
     void setMagCap(int usrMC) {magcap = usrMC;}
     void setMagAmmo(int usrMA) {magammo = usrMA;}
     void reload();
-    void reloadClick() {reloading-=1;} // decreasing value of reloading by 1
+    void finishReload() {reloading = 0;} // called by the reload timer
     bool isReloading() const;
     void print() const;
     char cprint();
 private:
-    int magcap;     // how much ammo the magazine can hold
-    int magammo;    // how much ammo is currently in active magazine
-    int reloading;  // counter
-    int ammo;       // how much ammo is left
-    int dmg;        // damage per hit
-    string model;   // name/ type of weapon
+    short magcap;   // how much ammo the magazine can hold
+    short magammo;  // how much ammo is currently in active magazine
+    short ammo;     // how much ammo is left
+    short dmg;      // damage per hit
+    unsigned char reloading;    // counter
+    unsigned char model;        // name/ type of weapon, index into models
+    static vector<string> models;   // every model name ever set, models[0] is ""
+    static mutex modelLock;
 };
 
+vector<string> weapon_t::models(1, "");
+mutex weapon_t::modelLock;
+
+string weapon_t::getModel() const {
+    lock_guard<mutex> hold(modelLock);
+    return models[model];
+}
+
+// looks the name up in the shared table, adding it the first time (at most 256 names)
+void weapon_t::setModel(string usrModel) {
+    lock_guard<mutex> hold(modelLock);
+    size_t i = find(models.begin(), models.end(), usrModel) - models.begin();
+    if (i == models.size() && models.size() < 256) models.push_back(usrModel);
+    model = i < models.size() ? i : 0;
+}
+
 // default constructor
 weapon_t::weapon_t() {
     magcap = 10;
@@ -333,7 +361,7 @@ weapon_t::weapon_t() {
     reloading = 0;
     ammo = 20;
     dmg = 5;
-    model = "";
+    model = 0;
 }
 
 
@@ -344,32 +372,24 @@ weapon_t::weapon_t(int usrCap, int usrMA, int usrA, int usrDMG, string usrModel)
     reloading = 0;
     ammo = usrA;
     dmg = usrDMG;
-    model = usrModel;
+    setModel(usrModel);
 }
 
 
 /*
  * function_identifier: calcs ammo needed to reload, performs reload if enough by adding/subtracting
- *                      from necessary vars. Decrements reloading 5 times to simulate time
+ *                      from necessary vars. The weapon stays reloading until the match's
+ *                      RELOAD_TICKS timer calls finishReload()
  * parameters: none
  * return value: none
  */
 void weapon_t::reload() {
     int needed = magcap - magammo;  // amount of ammo needed from total ammo
-    if ((ammo - needed) >= 0) {     // ensuring there's enough ammo
-        reloading = 5;
+    if (!isReloading() && (ammo - needed) >= 0) {     // ensuring there's enough ammo
+        reloading = RELOAD_TICKS;
         ammo -= needed;             // subtract from total
         magammo += needed;          // add to gun ammo
-        for (int j = reloading; j > 0; j--) {   // loops 5 times, calling reloadclick() which decrements relaod
-#ifdef curses
-            printw("%i", reloading);            // printing info to show function works, will remove later
-#else
-            cout << reloading;
-#endif
-            reloadClick();
-        }
     }
-    // in Part II of assingment
 }
 
 // checks if weapon is reloading by tapping into reloading member var
@@ -385,11 +405,11 @@ bool weapon_t::isReloading() const {
  */
 void weapon_t::print() const {
 #ifdef curses
-    printw("\nWeapon Information: \nmodel: %s\nmagcap: %i\nmagammo: %i\nreloading: %i\nammo: %i\ndmg: %i\n", model.c_str(), magcap, magammo, reloading, ammo, dmg);
+    printw("\nWeapon Information: \nmodel: %s\nmagcap: %i\nmagammo: %i\nreloading: %i\nammo: %i\ndmg: %i\n", getModel().c_str(), magcap, magammo, reloading, ammo, dmg);
 #else
-    cout << "Weapon Information: " << endl << "model: " << model << endl <<
+    cout << "Weapon Information: " << endl << "model: " << getModel() << endl <<
     "magcap: " << magcap << endl << "magammo: " << magammo << endl <<
-    "reloading: " << reloading << endl << "ammo: " << ammo << endl << "dmg: " << dmg << endl;
+    "reloading: " << (int)reloading << endl << "ammo: " << ammo << endl << "dmg: " << dmg << endl;
 #endif
 }
 
@@ -398,6 +418,55 @@ char weapon_t::cprint() {
     return '&';
 }
 
+const int SLOT_SHORT = 0;           // inventory slots, one per kind of weapon lying around
+const int SLOT_LONG = 1;
+const int INVENTORY_SLOTS = 2;
+
+/*
+ * class_identifier: the weapons one player carries, a slot per kind ('#' and '!'). each slot is a
+ *                   whole weapon_t, so magazine, spare ammo and damage come with it when it's picked up,
+ *                   and picking up a kind that's already held only adds its rounds to the spare ammo
+ * constructors: inventory_t()
+ * public functions:    bool has(int slot) const
+ *                      weapon_t& get(int slot)
+ *                      void take(int slot, const weapon_t& w)
+ *                      bool use(int slot)
+ *                      void clear()
+ * static members: none
+ */
+
+class inventory_t {
+public:
+    inventory_t() {clear();}
+    bool has(int slot) const {return held[slot];}
+    weapon_t& get(int slot) {return slots[slot];}
+    const weapon_t& get(int slot) const {return slots[slot];}
+    void take(int slot, const weapon_t& w);
+    bool use(int slot);
+    void clear() {for (int i = 0; i < INVENTORY_SLOTS; i++) held[i] = false;}
+private:
+    weapon_t slots[INVENTORY_SLOTS];
+    bool held[INVENTORY_SLOTS];
+};
+
+void inventory_t::take(int slot, const weapon_t& w) {
+    if (!held[slot]) {
+        slots[slot] = w;
+        held[slot] = true;
+        return;
+    }
+    weapon_t& mine = slots[slot];
+    mine.setAmmo(std::min(mine.getAmmo() + w.getMagAmmo() + w.getAmmo(), 30000));   // ammo is a short
+}
+
+// spends one round from slot's magazine, false if the slot is empty, reloading or out of rounds
+bool inventory_t::use(int slot) {
+    weapon_t& w = slots[slot];
+    if (!held[slot] || w.isReloading() || w.getMagAmmo() == 0) return false;
+    w.setMagAmmo(w.getMagAmmo() - 1);
+    return true;
+}
+
 /*
  * function_identifier: print obstacle information
  * parameters: none
@@ -405,28 +474,26 @@ char weapon_t::cprint() {
  */
 void obstacle_t::printObstacle() const {
 #ifdef curses
-    printw("Obstacle id: %s", id.c_str());
+    printw("Obstacle id: %s", getId().c_str());
 #else
-    cout << "Obstacle Id: " << id << endl;
+    cout << "Obstacle Id: " << getId() << endl;
 #endif
     entprint();
-    pos.print();
+    pos().print();
 }
 
 class trigger_t : public ent_t {
 public:
     trigger_t(char symbol = '#');
     trigger_t(string, char);
-    string whatIDo() const {return info;}
-    void setWhatIDo(string usrin) {info = usrin;} // info setter
+    string whatIDo() const {return getLabel();}
+    void setWhatIDo(string usrin) {setLabel(usrin);} // info setter
     char getId() const {return id;}
     void setId(char usrid) {id = usrid;}          // id setter
     char cprint();
     void setSymbol(char symb);
 private:
-    string info;
     char id;
-    char symbol;
 };
 
 // default constructor, initializing info and id
@@ -437,21 +504,197 @@ private:
 
 void trigger_t::setSymbol(char symb) {
     this->symbol = symb;
+    glyph() = symb;
 }
 
 trigger_t::trigger_t(char symbol){
     this->symbol = symbol;
+    id = '?';
 }
 
 char trigger_t::cprint() {
     // printw("%c", '#');
-    return symbol;
+    return glyph();
 }
 
 // constructor, initializing info and id to usr vars
 trigger_t::trigger_t(string usrInfo, char usrid) {
-    info = usrInfo;
+    setLabel(usrInfo);
     id = usrid;
+    symbol = '#';
+}
+
+const unsigned COMP_POS = 1;       // components an archetype can have
+const unsigned COMP_HP = 2;
+const unsigned COMP_WEAPON = 4;
+const unsigned COMP_GLYPH = 8;
+const unsigned COMP_ALIVE = 16;
+const unsigned COMP_INVENTORY = 32;
+
+const int ARCH_PLAYER = 0;          // players, row == pid
+const int ARCH_OBSTACLE = 1;        // the random '@'s, they can be shot down
+const int ARCH_PICKUP = 2;          // '#' and '!' weapons lying on the grid, short ones first
+const int ARCH_WALL = 3;            // authored walls, one entity stands for every '@' cell
+const int ARCH_COUNT = 4;
+const unsigned ARCH_COMPONENTS[ARCH_COUNT] = {
+    COMP_POS | COMP_HP | COMP_INVENTORY | COMP_GLYPH | COMP_ALIVE,
+    COMP_POS | COMP_HP | COMP_GLYPH | COMP_ALIVE,
+    COMP_POS | COMP_GLYPH | COMP_WEAPON,    // the weapon is what whoever picks it up gets
+    COMP_GLYPH
+};
+
+/*
+ * class_identifier: archetype storage for one match's entities. each archetype keeps its components
+ *                   as parallel columns (every position together, every hp together, ...), so a
+ *                   system walks one dense array instead of hopping from object to object.
+ *                   the ent_t objects on the grid are handles into these columns
+ *                   columns are sized once by reserve() and rows are never removed (a dead entity
+ *                   keeps its row with alive false), so rows and column pointers stay valid for
+ *                   the whole match. every archetype also has a cold column (id, creation time,
+ *                   label) that only the print paths read
+ * constructors: world_t()
+ * public functions:    void reserve(int arch, int capacity)
+ *                      int add(int arch, ent_t* owner)
+ *                      int count(int arch) const
+ *                      bool has(int arch, unsigned comp) const
+ *                      coord_t* pos(int arch)
+ *                      health_t* hp(int arch)
+ *                      weapon_t* weapons(int arch)
+ *                      inventory_t* inventories(int arch)
+ *                      char* glyphs(int arch)
+ *                      bool* alive(int arch)
+ *                      ent_t** owners(int arch)
+ *                      cold_t& cold(int arch, int row)
+ *                      int made() const
+ * static members: none
+ */
+
+class world_t {
+public:
+    struct cold_t {
+        int id;                         // 1.., in the order add() saw them
+        time_t creationTime;
+        string label;
+    };
+    world_t() {added = 0;}
+    world_t(const world_t&) = delete;   // the handles point at this world
+    world_t& operator=(const world_t&) = delete;
+    void reserve(int arch, int capacity);
+    int add(int arch, ent_t* owner);
+    int count(int arch) const {return arches[arch].count;}
+    bool has(int arch, unsigned comp) const {return (ARCH_COMPONENTS[arch] & comp) != 0;}
+    coord_t* pos(int arch) {return arches[arch].pos.get();}         // null if arch has no such component
+    health_t* hp(int arch) {return arches[arch].hp.get();}
+    weapon_t* weapons(int arch) {return arches[arch].wep.get();}
+    inventory_t* inventories(int arch) {return arches[arch].inv.get();}
+    char* glyphs(int arch) {return arches[arch].glyph.get();}
+    bool* alive(int arch) {return arches[arch].alive.get();}
+    ent_t** owners(int arch) {return arches[arch].owner.get();}
+    cold_t& cold(int arch, int row) {return arches[arch].cold[row];}
+    int made() const {return added;}    // entities this world has handed a row
+private:
+    struct archetype_t {
+        int count = 0;
+        int capacity = 0;
+        unique_ptr<coord_t[]> pos;
+        unique_ptr<health_t[]> hp;
+        unique_ptr<weapon_t[]> wep;
+        unique_ptr<inventory_t[]> inv;
+        unique_ptr<char[]> glyph;
+        unique_ptr<bool[]> alive;
+        unique_ptr<ent_t*[]> owner;     // back to the grid handle, for systems that write the grid
+        unique_ptr<cold_t[]> cold;
+    };
+    archetype_t arches[ARCH_COUNT];
+    int added;
+};
+
+// allocates arch's columns, only before its first add()
+void world_t::reserve(int arch, int capacity) {
+    archetype_t& a = arches[arch];
+    unsigned comps = ARCH_COMPONENTS[arch];
+    a.capacity = capacity;
+    if (comps & COMP_POS) a.pos.reset(new coord_t[capacity]);
+    if (comps & COMP_HP) a.hp.reset(new health_t[capacity]);
+    if (comps & COMP_WEAPON) a.wep.reset(new weapon_t[capacity]);
+    if (comps & COMP_INVENTORY) a.inv.reset(new inventory_t[capacity]);
+    if (comps & COMP_GLYPH) a.glyph.reset(new char[capacity]);
+    if (comps & COMP_ALIVE) a.alive.reset(new bool[capacity]);
+    a.owner.reset(new ent_t*[capacity]);
+    a.cold.reset(new cold_t[capacity]);
+}
+
+/*
+ * function_identifier: gives owner the next row of arch and turns it into a handle to that row.
+ *                      components start at their defaults, the glyph is owner's symbol and the
+ *                      cold column gets the next id and the current time
+ * parameters: archetype, the grid entity
+ * return value: the row, -1 if arch is full (owner stays outside the world)
+ */
+int world_t::add(int arch, ent_t* owner) {
+    archetype_t& a = arches[arch];
+    if (a.count == a.capacity) return -1;
+    int row = a.count++;
+    if (a.glyph) a.glyph[row] = owner->symbol;
+    if (a.alive) a.alive[row] = ALIVE;
+    a.owner[row] = owner;
+    a.cold[row].id = ++added;
+    a.cold[row].creationTime = time(NULL);
+    owner->world = this;
+    owner->arch = arch;
+    owner->row = row;
+    return row;
+}
+
+inline coord_t& ent_t::pos() {return world->pos(arch)[row];}
+inline const coord_t& ent_t::pos() const {return world->pos(arch)[row];}
+inline health_t& ent_t::hp() {return world->hp(arch)[row];}
+inline char& ent_t::glyph() {return world != nullptr ? world->glyphs(arch)[row] : symbol;}
+
+int ent_t::getId() const {
+    return world != nullptr ? world->cold(arch, row).id : 0;
+}
+
+void ent_t::setId(int usrId) {
+    if (world != nullptr) world->cold(arch, row).id = usrId;
+}
+
+string ent_t::getLabel() const {
+    return world != nullptr ? world->cold(arch, row).label : string();
+}
+
+void ent_t::setLabel(const string& label) {
+    if (world != nullptr) world->cold(arch, row).label = label;
+}
+
+/*
+ * function_identifier: prints entity's infomation in both ncurses and not
+ * parameters: none
+ * return value: none
+ */
+void ent_t::entprint() const {
+    int id = getId(), made = world != nullptr ? world->made() : 0;
+#ifdef curses
+    printw("Entity: %i/%i\nStatus: %i\nCreated: ", id, made, status);
+    printCreationTime();
+#else
+    cout << "Entity: " << id << "/" << made << endl << "Status: ";
+    if (status == 1) cout << "Alive";
+    else if (status == 0) cout << "Dead";
+    else cout << "undefined";
+    cout << endl << "Created: ";
+    printCreationTime();
+#endif
+}
+
+// prints creation time in both ncurses and not, entities outside a world print the epoch
+void ent_t::printCreationTime() const {
+    time_t creationTime = world != nullptr ? world->cold(arch, row).creationTime : 0;
+#ifdef curses
+    printw("%s", ctime(&creationTime));
+#else
+    cout << ctime(&creationTime);
+#endif
 }
 
 int max(int x, int y, int z, int k) {
@@ -484,31 +727,81 @@ class blank : public ent_t{
  * public functions:    void initGrid()
  *                      void print() const
  *                      void clearScreen() const
- *                      void addObstacle(coord_t&)
- *                      void addPlayer(coord_t&, int)
- *                      void addTrigger(coord_t& c, char ch)
  *                      void updatePosition(ent_t)
+ *                      void setCell(int x, int y, ent_t* ent)
+ *                      bool isOpaque(int x, int y)
+ *                      char glyphAt(int x, int y)
+ *                      ent_t* at(int x, int y) const
+ *                      unsigned long long stateHash() const
+ *                      void trackChanges()
+ *                      void takeChanges(vector<int>& out)
  * static members: none
  */
 
+// what a writeCell() changed, so cellWritten() knows who to tell
+const int CELL_FLIP_OPAQUE = 1;     // '@' appeared or vanished - fov and flow
+const int CELL_FLIP_BLOCKER = 2;    // '@' or a player appeared or vanished - threat
+const int CELL_FLIP_GLYPH = 4;      // the cell looks different - the hash
+const int CELL_OLD_GLYPH_SHIFT = 8; // with CELL_FLIP_GLYPH, the glyph it had sits above the flip bits
+
+/*
+ * function_identifier: zobrist key of one glyph on one cell. the key is a mix of the two instead of a
+ *                      table lookup, so every map size gets the same keys without storing any, and a
+ *                      client that only ever sees glyphs can keep the same hash as the server.
+ *                      an empty cell's key is 0, so a fresh grid hashes to 0. another salt gives an
+ *                      unrelated set of keys, for a second hash that checks the first
+ * parameters: y * cols + x, glyph, salt
+ * return value: the key
+ */
+const unsigned long long ZOBRIST_SALT = 0x9E3779B97F4A7C15ULL;
+const unsigned long long ZOBRIST_CHECK_SALT = 0xD1B54A32D192ED03ULL;
+
+unsigned long long zobristKey(int cell, char glyph, unsigned long long salt = ZOBRIST_SALT) {
+    if (glyph == ' ') return 0;
+    unsigned long long z = ((unsigned long long)cell << 8 | (unsigned char)glyph) + salt;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;        // splitmix64 finalizer
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+class fov_t;
+class flowfield_t;
+class threatmap_t;
+class minimap_t;
+class rewind_t;
+class player_t;
+class timerwheel_t;
+class bandpool_t;
+
 class map_t : public ent_t {
 public:
-    map_t(int urows = 50, int ucols = 14);
+    map_t(int urows = 50, int ucols = 14, unsigned int seed = 1);
+    ~map_t();
     void initGrid();  // iniitialize grid to blanks
     void print() const;
     void dynamicPrint();
+    char shownAt(int x, int y);                 // glyph after fog of war, what dynamicPrint() draws
+    void snapshot(vector<char>& out, int x0, int y0, int w, int h);    // shownAt() of a window, row by row
     void clearScreen() const;
-    void addObstacle(coord_t&);
-    void addPlayer(coord_t&, int);
     void dynAddEnt(ent_t* e, coord_t&);
-    void addTrigger(coord_t& c, char ch);
-    void updatePosition(ent_t, ent_t*);
+    void updatePosition(ent_t&, coord_t, ent_t*);
+    void setCell(int x, int y, ent_t* ent);  // every write to egrid goes through here
+    int writeCell(int x, int y, ent_t* ent); // just the write, returns the CELL_FLIP_* bits for cellWritten()
+    void cellWritten(int x, int y, int flips, ent_t* was);    // change tracking and observers for a writeCell()
+    bool isOpaque(int x, int y);             // true for '@' cells and anything off the grid
+    char glyphAt(int x, int y);              // what the cell looks like on screen
+    ent_t* at(int x, int y) const;           // egrid[y][x], nullptr off the grid
+    unsigned long long stateHash() const {return hash;}    // XOR of zobristKey() over every cell
+    unsigned long long stateCheck() const {return check;}  // the same with ZOBRIST_CHECK_SALT keys
+    void trackChanges();                     // start recording which cells setCell() touches
+    void takeChanges(vector<int>& out);      // hands over (and resets) the changed cell indices
     // for testing purposes
     int getRows() const {return rows;}
     int getCols() const {return cols;}
-    friend void update(map_t &m,ent_t*e, ent_t*p, int& pU, int& pR, int& pD, int& pL);          // updates the map with storm
+    friend void update(map_t &m, ent_t*e, player_t*p, timerwheel_t& timers, bandpool_t& pool, int threads);    // updates the map with storm
     // friend void secondUpdate(map_t &m, ent_t*e, ent_t*p);
     void calcRadius();      // calculates and returns radius
+    void setCenter(int x, int y);   // moves the storm's center and recomputes the distances around it
     // ~map_t();               // adding a destructor to deallocate the new grid at end of program
     int radius;
     int dXR;    // x dist to the right of center
@@ -516,91 +809,104 @@ public:
     int dYU;    // y dist up of center
     int dYB;    // y dist down of center
     coord_t centerCoord;
-    char **grid;
     char cprint();
 // private:
     ent_t*** egrid;    // creating the new grid(a 2-d array of ent_t pointers)
     int rows;
     int cols;
+    fov_t* fov;        // notified when a cell turns opaque/transparent, nullptr if unused
+    flowfield_t* flow; // same, for the path field
+    threatmap_t* threat;   // notified when something that stops a shot appears or vanishes
+    minimap_t* minimap;    // notified of every write
+    rewind_t* journal;     // told what every write replaced, nullptr unless someone can rewind
+    int viewer;        // pid whose fog of war dynamicPrint() draws, -1 shows everything
+    vector<int> changed;                // y*cols+x of every cell written since takeChanges()
+    vector<unsigned char> changedFlag;  // dedupes changed[], empty when tracking is off
+    unsigned long long hash;            // kept by cellWritten(), one XOR pair per glyph change
+    unsigned long long check;           // ditto
 };
 
 char map_t::cprint() {
-    symbol = 's';
-    return 's';
+    return 's';                     // symbol is set once in the constructor, storm bands call this concurrently
 }
 
 void map_t::dynAddEnt(ent_t* e, coord_t& c){
-    egrid[c.y][c.x] = e;                        // storing the entity in the array
+    setCell(c.x, c.y, e);                       // storing the entity in the array
 }
 
-void map_t::dynamicPrint() {
-    for (int i = 0; i < GRIDY; i++) {
-        for (int j = 0; j < GRIDX; j++) {
-            if (egrid[i][j] != nullptr) 
-                printw("%c", egrid[i][j]->cprint());
-            else 
-                printw("%c", ' ');
-        }
-        printw("\n");
-    }
+ent_t* map_t::at(int x, int y) const {
+    if (x < 0 || y < 0 || x >= cols || y >= rows) return nullptr;
+    return egrid[y][x];
+}
+
+char map_t::glyphAt(int x, int y) {
+    if (egrid[y][x] == nullptr) return ' ';
+    return egrid[y][x]->cprint();
+}
+
+void map_t::trackChanges() {
+    changedFlag.assign(rows * cols, 0);
+    changed.clear();
+}
+
+void map_t::takeChanges(vector<int>& out) {
+    out.clear();
+    out.swap(changed);
+    for (size_t i = 0; i < out.size(); i++) changedFlag[out[i]] = 0;
+}
+
+bool map_t::isOpaque(int x, int y) {
+    if (x < 0 || y < 0 || x >= cols || y >= rows) return true;  // edge of the world blocks sight
+    return egrid[y][x] != nullptr && egrid[y][x]->cprint() == '@';
 }
 
 // defualt paramater, intiializing the grid
-map_t::map_t(int urows, int ucols) {
+map_t::map_t(int urows, int ucols, unsigned int seed) {
     this->rows = urows;
     this->cols = ucols;
+    this->fov = nullptr;
+    this->flow = nullptr;
+    this->threat = nullptr;
+    this->minimap = nullptr;
+    this->journal = nullptr;
+    this->viewer = -1;
+    this->hash = 0;                 // every cell starts empty
+    this->check = 0;
+    this->symbol = 's';             // what updateStatus() looks for under a player
 
     // dynamically allocating 2d array of ent_t pointers
     egrid = new ent_t**[this->rows];
     for (int i = 0; i < urows; i++)
         egrid[i] = new ent_t*[this->cols];
 
-    // creating 2d pointer array
-    grid = new char*[this->rows];  // creates array of pointers
+    centerCoord.rando(cols, rows, seed);       // creates a random center
+    setCenter(centerCoord.x, centerCoord.y);
+    initGrid();
+    // grid[centerCoord.y][centerCoord.x] = ' ';    // print out location
+}
+
+// the grid only points at entities owned elsewhere, so only the arrays themselves are freed
+map_t::~map_t() {
     for (int i = 0; i < rows; i++) {
-        grid[i] = new char[this->cols];
+        delete [] egrid[i];                 // deallocating data in each row
     }
+    delete [] egrid;                        // deallocating the final 1d array of pointers
+}
 
-    centerCoord.rando();       // creates a random center
-
-    dXR = GRIDX - centerCoord.x;
+void map_t::setCenter(int x, int y) {
+    centerCoord = coord_t(x, y);
+    dXR = cols - centerCoord.x;
     dXL = centerCoord.x;
     dYU = centerCoord.y;
-    dYB = GRIDY - centerCoord.y - 1;
-
+    dYB = rows - centerCoord.y - 1;
     calcRadius();
-    initGrid();
-    // grid[centerCoord.y][centerCoord.x] = ' ';    // print out location
 }
 
-// map_t::~map_t() {
-//     for (int i = 0; i < rows; i++) {
-//         for (int j = 0; j < cols; j++) {
-//             delete newgrid[i][j];
-//         }
-//         delete [] newgrid[i];               // deallocating data in each row
-//     }
-//     delete [] newgrid;                      // deallocating the final 1d array of pointers
-// }
-
 void map_t::calcRadius() {
     this->radius = max(dXR, dXL, dYU, dYB);
     // this -> radius = max2(dYU, dYB);
 }
 
-//  adds player to coordinates passed into function
-void map_t::addPlayer(coord_t& c, int pid) {
-    grid[c.y][c.x] = (char)(pid+INT_TO_UPPER_ALPH);     // casting into a character
-}
-
-void map_t::addObstacle(coord_t& c) {
-    grid[c.y][c.x] = '@';
-}
-
-void map_t::addTrigger(coord_t& c, char chr) {
-    grid[c.y][c.x] = chr;
-}
-
 // initialize grid to blanks
 void map_t::initGrid() {
     for (int i = 0; i < this->rows; i++) {
@@ -618,19 +924,15 @@ void map_t::initGrid() {
 
 /*
  * function_identifier: update position of entity by setting old position to ' ', and the new position to 'A'
- * parameters: none
+ * parameters: the entity (already at its new position), where it was, what to leave behind
  * return value: none
  */
-void map_t::updatePosition(ent_t myEnt, ent_t* blank) {
-    // grid[myEnt.pos.getOldy()][myEnt.pos.getOldx()] = ' ';
-    // cout << "old x" << myEnt.pos.getOldx() <<"old y" << myEnt.pos.getOldy() ;
+void map_t::updatePosition(ent_t& myEnt, coord_t from, ent_t* blank) {
+    // grid[from.y][from.x] = ' ';
     
-    egrid[myEnt.pos.getOldy()][myEnt.pos.getOldx()] = blank;    // make it point to the blank
-    // printw("%c", egrid[myEnt.pos.getOldy()][myEnt.pos.getOldx()]->cprint());
+    setCell(from.x, from.y, blank);     // make it point to the blank
     // grid[myEnt.pos.y][myEnt.pos.x] = 'A'; // supposing only entity whose position can be updated is the player until part II
-    egrid[myEnt.pos.y][myEnt.pos.x] = &myEnt;
-    myEnt.pos.setOldx(myEnt.pos.x);
-    myEnt.pos.setOldy(myEnt.pos.y);
+    setCell(myEnt.pos().x, myEnt.pos().y, &myEnt);
 }
 
 /*
@@ -663,13 +965,12 @@ void map_t::clearScreen() const {
  *                      void moveDown();
  *                      void moveRight();
  *                      void moveLeft();
- *                      void storeLocation(map_t);
- *                      void updateStatus(map_t);
+ *                      void updateStatus(map_t&);
  *                      void printStatus();
- *                      void chooseLastAlive();
- * static members:      lastAlive
- *                      playerStatus[PLAYERCNT]
- *                      playerLocation[PLAYERCNT][3]
+ *                      void chooseLastAlive(unsigned int& rng);
+ *                      void setBounds(int cols, int rows);
+ *                      inventory_t& inv();
+ * static members: none
  */
 
 class player_t : public ent_t, public move {
@@ -677,51 +978,48 @@ public:
     player_t();
     void print();
     char cprint();
-    void setPid(int usrPid) {pid = usrPid;}
-    void setPname(string usrPname) {name = usrPname;}
+    void setPid(int usrPid) {pid = usrPid; glyph() = (char)(pid+INT_TO_UPPER_ALPH);}
+    void setPname(string usrPname) {setLabel(usrPname);}
     int getPid() const {return pid;}
-    string getPname() const {return name;}
+    string getPname() const;
     void moveUp();
     void moveDown();
     void moveRight();
     void moveLeft();
-    void storeLocation(map_t);
-    void updateStatus(map_t);
+    void updateStatus(map_t&);
     void printStatus() {printw("%i status: %i\n", pid, playerStatus[pid]);}
-    void chooseLastAlive();
+    void chooseLastAlive(unsigned int& rng);   // draws from the match's random state
     void removePlayer();
+    void setBounds(int cols, int rows) {gridCols = cols; gridRows = rows;}
+    inventory_t& inv() {return getWorld()->inventories(ARCH_PLAYER)[getRow()];}
 public:
-    weapon_t wep;
-    static int lastAlive;                       // randomly chosen last char alive
-    static bool playerStatus[PLAYERCNT];        // 1d array to store player if player is dead or alive
-    static double playerLocation[PLAYERCNT][3]; // array common to all players to store location
-                                                // stores: id, x, y
-    health_t hp;
+    int lastAlive;                              // randomly chosen last char alive
+    bool* playerStatus;                         // the match's alive column, stores if each player is dead or alive
 private:
-    
-    string name;
     int pid;
-    static int pCnt;
+    int gridCols;                               // size of the map the player walks on
+    int gridRows;
 };
 
-int player_t::pCnt = 0;
-
-double player_t::playerLocation[PLAYERCNT][3] = {{0}};     //initialize 2d array to 0s
-bool player_t::playerStatus[PLAYERCNT] = {ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, 
-ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, 
-ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE, ALIVE};          //initialize all players to be alive
-int player_t::lastAlive = 0;                              
-
-// defualt constructor setting pid and name
+// defualt constructor setting pid and name, the match hands out pids and the status array
 player_t::player_t() {
-    pid = pCnt++;
-    string spid = to_string(pid);   // pid as string
-    name = "Player " + spid;
+    pid = 0;
+    lastAlive = 0;
+    playerStatus = nullptr;
+    gridCols = GRIDX;
+    gridRows = GRIDY;
+}
+
+// "Player <pid>" unless setPname() gave it something else
+string player_t::getPname() const {
+    string name = getLabel();
+    if (name.empty()) name = "Player " + to_string(pid);
+    return name;
 }
 
 // if player is inside of storm, their status changes to DEAD
-void player_t::updateStatus(map_t m) {
-    if (m.egrid[pos.y][pos.x]->symbol == 's') {         // checks if its in the storm
+void player_t::updateStatus(map_t &m) {
+    if (m.egrid[pos().y][pos().x] != nullptr && m.egrid[pos().y][pos().x]->symbol == 's') {         // checks if its in the storm
         this->playerStatus[this->pid] = DEAD;           // sets it to DEAD in that case
         
     }       
@@ -732,11 +1030,11 @@ void player_t::removePlayer( ){
 }
 // randomly selects a player that is alive
 // this function is called when choosing a winner in case of draw
-void player_t::chooseLastAlive() {
-    bool selected = false;
-    int pid = 0; 
-    while (selected == false) {
-        int pid = (rand()%(PLAYERCNT+1));
+void player_t::chooseLastAlive(unsigned int& rng) {
+    bool anyAlive = false;
+    for (int i = 0; i < PLAYERCNT; i++) if (playerStatus[i] == ALIVE) anyAlive = true;
+    while (anyAlive) {                          // keeps the old pick once everyone is dead
+        int pid = (rand_r(&rng)%PLAYERCNT);
         if (this->playerStatus[pid] == ALIVE) {
             lastAlive = pid;
             return;
@@ -744,17 +1042,6 @@ void player_t::chooseLastAlive() {
     }
 }
 
-/*
- * function_identifier: stores player info into 2d array common to all players
- * parameters: none
- * return value: none
- */
-void player_t::storeLocation(map_t m) {
-    playerLocation[pid][0] = pid;           // storing the character
-    playerLocation[pid][1] = pos.x;         // storing x   
-    playerLocation[pid][2] = pos.y;         // storing y
-}
-
 /*
  * function_identifier: sets player's old position to current pos
  *                      and updated current position as long as it's within boundaries
@@ -762,27 +1049,19 @@ void player_t::storeLocation(map_t m) {
  * return value: none
  */
 void player_t::moveUp() {
-    pos.setOldx(pos.x);         // copies current position to old so that updatePos() can make it blank
-    pos.setOldy(pos.y);
-    if (pos.y >= 1) pos.y -= 1; // checks that player doesn't leave boundaries
+    if (pos().y >= 1) pos().y -= 1; // checks that player doesn't leave boundaries
 }
 
 void player_t::moveDown() {
-    pos.setOldx(pos.x);
-    pos.setOldy(pos.y);
-    if (pos.y < GRIDY-1) pos.y += 1;
+    if (pos().y < gridRows-1) pos().y += 1;
 }
 
 void player_t::moveRight() {
-    pos.setOldx(pos.x);
-    pos.setOldy(pos.y);
-    if (pos.x < GRIDX-1) pos.x += 1;
+    if (pos().x < gridCols-1) pos().x += 1;
 }
 
 void player_t::moveLeft() {
-    pos.setOldx(pos.x);
-    pos.setOldy(pos.y);
-    if (pos.x >= 1) pos.x -= 1;
+    if (pos().x >= 1) pos().x -= 1;
 }
 
 /*
@@ -792,22 +1071,21 @@ void player_t::moveLeft() {
  * return value: none
  */
 void player_t::print() {
-    string spid = to_string(pid);   // in case pid changes after obj is created
-    name = "Player " + spid;        // reflect changes to name
+    string name = "Player " + to_string(pid);   // in case pid changes after obj is created
 #ifdef curses
     printw("%s\n", name.c_str());
     entprint();
     printw("Player position: ");
-    pos.print();
+    pos().print();
 #else
     cout << name << endl;           // prints player name + id
     entprint();                     // prints metadata
-    cout << "Player position: "; pos.print(); // prints position
+    cout << "Player position: "; pos().print(); // prints position
 #endif  
 }
 
 char player_t::cprint() {
-    return (char)(pid+INT_TO_UPPER_ALPH);     // PID casted into a character
+    return glyph();     // PID casted into a character by setPid()
 }
 
 class empty_t: public ent_t {
@@ -817,515 +1095,4443 @@ class empty_t: public ent_t {
 
 empty_t e;
 
-void updatePos(map_t &map, player_t &p){
-    map.egrid[p.pos.getOldy()][p.pos.getOldx()] = &e;
-    map.egrid[p.pos.y][p.pos.x] = &p;
-    p.pos.setOldx(p.pos.x);
-    p.pos.setOldy(p.pos.y);
+// what's left on a cell someone walks off or dies on: open ground, or storm if it's outside the safe zone
+ent_t* leftBehind(map_t& map, int x, int y) {
+    const coord_t& c = map.centerCoord;
+    bool safe = x >= c.x - map.dXL && x <= c.x + map.dXR && y >= c.y - map.dYU && y <= c.y + map.dYB;
+    return safe ? (ent_t*)&e : &map;
 }
 
 /*
- * function_identifier: moves player on map, depending on key user has pressed
- * parameters: map_t &map, player_t &p, obstacle_t*o, trigger_t *shortWep, trigger_t* longWep, int direction, bool& haveShort, bool& haveLong
+ * class_identifier: per-player field of view, computed by recursive shadowcasting over '@' cells
+ *                   each player's view is split into 8 octants that are kept separately, so that a
+ *                   destroyed obstacle or a moved player only recomputes the octants it touches
+ *                   the seen[] counts are shared by everyone (fog of war, AI) and answer
+ *                   "who can see this cell" without rescanning
+ * constructors: fov_t()
+ * public functions:    void init(map_t*, player_t*, int)
+ *                      void playerMoved(int pid)
+ *                      void cellChanged(int x, int y)
+ *                      void refresh()
+ *                      bool canSee(int pid, int x, int y) const
+ *                      int seenBy(int x, int y) const
+ * static members: none
+ */
+
+class fov_t {
+public:
+    fov_t() {map = nullptr; players = nullptr; count = 0;}
+    void init(map_t* m, player_t* p, int pcount);
+    void playerMoved(int pid);          // origin changed, every octant is stale
+    void cellChanged(int x, int y);     // a cell flipped between opaque and transparent
+    void refresh();                     // recomputes only the dirty octants
+    bool canSee(int pid, int x, int y) const;
+    int seenBy(int x, int y) const {return seen[y * map->cols + x];}
+private:
+    struct view_t {
+        int ox, oy;                     // origin the octants were cast from
+        unsigned char dirty;            // 1 bit per octant
+        vector<unsigned char> vis;      // (2R+1)^2 window around origin, how many octants lit it
+        vector<int> oct[8];             // window cells lit by each octant
+    };
+    void clearOctant(int pid, int oct);
+    void castOctant(int pid, int oct);
+    void cast(int pid, int oct, int row, double start, double end);
+    void mark(int pid, int oct, int x, int y);
+    map_t* map;
+    player_t* players;
+    int count;
+    vector<view_t> views;
+    vector<unsigned short> seen;        // per map cell, how many players see it
+};
+
+// octant transforms used by the shadowcaster (local col/row -> grid dx/dy)
+static const int OCT_XX[8] = {1, 0, 0, -1, -1, 0, 0, 1};
+static const int OCT_XY[8] = {0, 1, -1, 0, 0, -1, 1, 0};
+static const int OCT_YX[8] = {0, 1, 1, 0, 0, -1, -1, 0};
+static const int OCT_YY[8] = {1, 0, 0, 1, -1, 0, 0, -1};
+
+const int FOV_WINDOW = 2 * FOV_RADIUS + 1;
+
+void fov_t::init(map_t* m, player_t* p, int pcount) {
+    map = m;
+    players = p;
+    count = pcount;
+    seen.assign(m->rows * m->cols, 0);
+    views.assign(pcount, view_t());
+    for (int i = 0; i < pcount; i++) {
+        views[i].vis.assign(FOV_WINDOW * FOV_WINDOW, 0);
+        views[i].ox = p[i].pos().x;
+        views[i].oy = p[i].pos().y;
+        views[i].dirty = 0xFF;
+    }
+    refresh();
+}
+
+bool fov_t::canSee(int pid, int x, int y) const {
+    const view_t& v = views[pid];
+    int wx = x - v.ox + FOV_RADIUS;
+    int wy = y - v.oy + FOV_RADIUS;
+    if (wx < 0 || wy < 0 || wx >= FOV_WINDOW || wy >= FOV_WINDOW) return false;
+    return v.vis[wy * FOV_WINDOW + wx] > 0;
+}
+
+void fov_t::playerMoved(int pid) {
+    view_t& v = views[pid];
+    if (v.ox == players[pid].pos().x && v.oy == players[pid].pos().y) return;
+    for (int i = 0; i < 8; i++) clearOctant(pid, i);  // unlight with the old origin
+    v.ox = players[pid].pos().x;
+    v.oy = players[pid].pos().y;
+    v.dirty = 0xFF;
+}
+
+/*
+ * function_identifier: marks the octants that contain (x, y) as dirty for every player that can see it
+ *                      an obstacle is lit when it's in view, so a player that can't see the cell
+ *                      right now can't be affected by it changing
+ * parameters: x, y of the changed cell
  * return value: none
  */
-void makemove(map_t &map, player_t &p, obstacle_t*o, trigger_t *shortWep, trigger_t* longWep, int direction, bool& haveShort, bool& haveLong) {
-#ifdef curses
-    bool obstacle = false;
-    bool player = false;
-    
-    if (direction == 119) {                                             // checking W
-        if (p.pos.y <= 0) {                                             // prevent going out of bounds
-            return;
+void fov_t::cellChanged(int x, int y) {
+    if (map == nullptr || seenBy(x, y) == 0) return;
+    for (int pid = 0; pid < count; pid++) {
+        if (!canSee(pid, x, y)) continue;
+        view_t& v = views[pid];
+        int dx = x - v.ox;
+        int dy = y - v.oy;
+        for (int i = 0; i < 8; i++) {
+            int lx = dx * OCT_XX[i] + dy * OCT_YX[i];     // transpose is the inverse transform
+            int ly = dx * OCT_XY[i] + dy * OCT_YY[i];
+            if (ly < 0 && lx >= ly && lx <= 0) v.dirty |= (1 << i);
         }
-        for (int i = 0; i < NUM_OF_OBSTACLES; i++){                     // looking at obstacles around
-            if (map.egrid[p.pos.y - 1][p.pos.x] == (o+i)) {
-                obstacle = true;
-            }
+    }
+}
+
+void fov_t::refresh() {
+    for (int pid = 0; pid < count; pid++) {
+        view_t& v = views[pid];
+        if (players[pid].playerStatus[pid] == DEAD) {       // dead players don't see anything
+            for (int i = 0; i < 8; i++) clearOctant(pid, i);
+            v.dirty = 0xFF;
+            continue;
         }
-        for (int i = 0; i< PLAYERCNT; i++) {                            // looking around for players
-            if (map.egrid[p.pos.y - 1][p.pos.x] == (&p+i)) {
-                player = true;
+        if (v.dirty == 0) continue;
+        for (int i = 0; i < 8; i++) {
+            if (v.dirty & (1 << i)) {
+                clearOctant(pid, i);
+                castOctant(pid, i);
             }
         }
+        v.dirty = 0;
+    }
+}
 
-        if (!obstacle && !player) {                                    // if no player or obstacle
-            for (int i = 0; i < NUM_SHORT_WEPS; i++) {                 // check if the next move is a short weapon
-                if (map.egrid[p.pos.y - 1][p.pos.x] == (shortWep+i)){
-                    haveShort = true;                                   // make it known that player has short wep
-                    break;
-                }
-            }
-            for (int i = 0; i < NUM_LONG_WEPS; i++) {                   // check if next move picks up long weapon
-                if (map.egrid[p.pos.y - 1][p.pos.x] == (longWep+i)){
-                    haveLong = true;                                    // make it known player has long wep
-                    break;
-                }
-            }
-            p.moveUp();                                                 // move player
-            updatePos(map, p);                                          // update player's position
-        }
-    } else if (direction == 115) {                                      // Checking S
-        if (p.pos.y >= GRIDY-1) {                                       // prevent going out of bounds
-            return;
-        }
-        for (int i = 0; i < NUM_OF_OBSTACLES; i++){
-            if (map.egrid[p.pos.y + 1][p.pos.x] == (o+i)) {
-                obstacle = true;
-            }
+void fov_t::clearOctant(int pid, int oct) {
+    view_t& v = views[pid];
+    for (size_t i = 0; i < v.oct[oct].size(); i++) {
+        int w = v.oct[oct][i];
+        if (--v.vis[w] == 0) {
+            int x = v.ox + w % FOV_WINDOW - FOV_RADIUS;
+            int y = v.oy + w / FOV_WINDOW - FOV_RADIUS;
+            seen[y * map->cols + x]--;
         }
-        
-         for (int i = 0; i< PLAYERCNT; i++) {
-            if (map.egrid[p.pos.y + 1][p.pos.x] == (&p+i)) {
-                player = true;
+    }
+    v.oct[oct].clear();
+}
+
+void fov_t::mark(int pid, int oct, int x, int y) {
+    view_t& v = views[pid];
+    int w = (y - v.oy + FOV_RADIUS) * FOV_WINDOW + (x - v.ox + FOV_RADIUS);
+    if (v.vis[w]++ == 0) seen[y * map->cols + x]++;
+    v.oct[oct].push_back(w);
+}
+
+// the origin belongs to octant 0 so it is lit exactly like any other cell
+void fov_t::castOctant(int pid, int oct) {
+    if (oct == 0) mark(pid, 0, views[pid].ox, views[pid].oy);
+    cast(pid, oct, 1, 1.0, 0.0);
+}
+
+/*
+ * function_identifier: recursive shadowcasting of one octant, row by row away from the origin
+ * parameters: pid, octant, row to start on, start and end slopes of the light
+ * return value: none
+ */
+void fov_t::cast(int pid, int oct, int row, double start, double end) {
+    if (start < end) return;
+    const view_t& v = views[pid];
+    double newStart = 0.0;
+    for (int j = row; j <= FOV_RADIUS; j++) {
+        bool blocked = false;
+        int dy = -j;
+        for (int dx = -j; dx <= 0; dx++) {
+            int x = v.ox + dx * OCT_XX[oct] + dy * OCT_XY[oct];
+            int y = v.oy + dx * OCT_YX[oct] + dy * OCT_YY[oct];
+            double lSlope = (dx - 0.5) / (dy + 0.5);
+            double rSlope = (dx + 0.5) / (dy - 0.5);
+            if (start < rSlope) continue;
+            else if (end > lSlope) break;
+
+            bool inGrid = x >= 0 && y >= 0 && x < map->cols && y < map->rows;
+            if (inGrid && dx * dx + dy * dy <= FOV_RADIUS * FOV_RADIUS) mark(pid, oct, x, y);
+
+            bool opaque = map->isOpaque(x, y);
+            if (blocked) {
+                if (opaque) {
+                    newStart = rSlope;
+                } else {
+                    blocked = false;
+                    start = newStart;
+                }
+            } else if (opaque && j < FOV_RADIUS) {
+                blocked = true;
+                cast(pid, oct, j + 1, start, lSlope);   // light what's left of the blocker
+                newStart = rSlope;
             }
         }
-        if (!obstacle && !player) {
-            for (int i = 0; i < NUM_SHORT_WEPS; i++) {
-                if (map.egrid[p.pos.y + 1][p.pos.x] == (shortWep+i)){
-                    haveShort = true;
-                    break;
-                }
+        if (blocked) break;
+    }
+}
+
+const int STORM_STEP_COST = 8;      // walking through the storm is allowed, but the field avoids it
+
+/*
+ * class_identifier: one shared flow field toward the safe zone center for every agent in the match
+ *                   dist[] is the cost of the cheapest walk to map->centerCoord around '@' cells
+ *                   (Dijkstra, storm cells cost extra). it's rebuilt once per storm round; between
+ *                   rounds a destroyed obstacle only relaxes the cells that actually got closer
+ *                   other players aren't part of the field, nextKey() steps around them locally
+ * constructors: flowfield_t()
+ * public functions:    void init(map_t* m)
+ *                      void invalidate()
+ *                      void cellChanged(int x, int y)
+ *                      void refresh()
+ *                      int distance(int x, int y) const
+ *                      int nextKey(int x, int y) const
+ * static members: none
+ */
+
+class flowfield_t {
+public:
+    flowfield_t() {map = nullptr; stale = true;}
+    void init(map_t* m);
+    void invalidate() {stale = true;}   // storm moved, rebuild on the next refresh()
+    void cellChanged(int x, int y);     // opacity flipped, applied on the next refresh()
+    void refresh();
+    int distance(int x, int y) const {return dist[y * map->cols + x];}
+    int nextKey(int x, int y) const;    // 'w', 'a', 's' or 'd' toward the center, 0 to stay put
+private:
+    typedef pair<int, int> entry_t;     // (dist, cell)
+    int cost(int cell);
+    void propagate();
+    map_t* map;
+    bool stale;
+    vector<int> dist;
+    vector<int> changed;                // cells that opened up since the last refresh
+    vector<entry_t> heap;               // min-heap, reused between runs
+};
+
+const int FLOW_UNREACHABLE = 0x3FFFFFFF;
+
+void flowfield_t::init(map_t* m) {
+    map = m;
+    dist.assign(m->rows * m->cols, FLOW_UNREACHABLE);
+    stale = true;
+    refresh();
+}
+
+// cost of stepping into a cell, -1 if it can't be entered
+int flowfield_t::cost(int cell) {
+    int x = cell % map->cols;
+    int y = cell / map->cols;
+    if (map->isOpaque(x, y)) return -1;
+    return map->at(x, y) == map ? STORM_STEP_COST : 1;
+}
+
+void flowfield_t::cellChanged(int x, int y) {
+    if (map != nullptr && !stale) changed.push_back(y * map->cols + x);
+}
+
+/*
+ * function_identifier: brings dist[] up to date - a full Dijkstra when stale, otherwise only
+ *                      the cells an opened obstacle made cheaper. a cell closing up can only make
+ *                      paths longer, which the incremental pass can't undo, so that rebuilds too
+ * parameters: none
+ * return value: none
+ */
+void flowfield_t::refresh() {
+    heap.clear();
+    if (!stale) {
+        for (size_t i = 0; i < changed.size() && !stale; i++) {
+            int c = changed[i];
+            if (cost(c) < 0) {stale = true; break;}
+            int x = c % map->cols, y = c / map->cols;
+            int best = dist[c];
+            static const int DX[4] = {0, 0, -1, 1};
+            static const int DY[4] = {-1, 1, 0, 0};
+            for (int d = 0; d < 4; d++) {
+                int nx = x + DX[d], ny = y + DY[d];
+                if (nx < 0 || ny < 0 || nx >= map->cols || ny >= map->rows) continue;
+                int nd = dist[ny * map->cols + nx];
+                if (nd < FLOW_UNREACHABLE && nd + cost(c) < best) best = nd + cost(c);
             }
-            for (int i = 0; i < NUM_LONG_WEPS; i++) {
-                if (map.egrid[p.pos.y + 1][p.pos.x] == (longWep+i)){
-                    haveLong = true;
-                    break;
-                }
+            if (best < dist[c]) {
+                dist[c] = best;
+                heap.push_back(entry_t(best, c));
+                push_heap(heap.begin(), heap.end(), greater<entry_t>());
             }
-            p.moveDown();
-            updatePos(map, p);
         }
-    } else if (direction == 100) {                                  // checking D
-        for (int i = 0; i < NUM_OF_OBSTACLES; i++){
-            if (map.egrid[p.pos.y][p.pos.x+1] == (o+i)) {
-                obstacle = true;
+    }
+    changed.clear();
+    if (stale) {
+        heap.clear();
+        dist.assign(map->rows * map->cols, FLOW_UNREACHABLE);
+        int center = map->centerCoord.y * map->cols + map->centerCoord.x;
+        dist[center] = 0;
+        heap.push_back(entry_t(0, center));
+        stale = false;
+    }
+    propagate();
+}
+
+void flowfield_t::propagate() {
+    static const int DX[4] = {0, 0, -1, 1};
+    static const int DY[4] = {-1, 1, 0, 0};
+    while (!heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), greater<entry_t>());
+        entry_t top = heap.back();
+        heap.pop_back();
+        if (top.first > dist[top.second]) continue;     // already found a cheaper way
+        int x = top.second % map->cols, y = top.second / map->cols;
+        for (int d = 0; d < 4; d++) {
+            int nx = x + DX[d], ny = y + DY[d];
+            if (nx < 0 || ny < 0 || nx >= map->cols || ny >= map->rows) continue;
+            int n = ny * map->cols + nx;
+            int c = cost(n);
+            if (c < 0 || top.first + c >= dist[n]) continue;
+            dist[n] = top.first + c;
+            heap.push_back(entry_t(dist[n], n));
+            push_heap(heap.begin(), heap.end(), greater<entry_t>());
+        }
+    }
+}
+
+int flowfield_t::nextKey(int x, int y) const {
+    static const int DX[4] = {0, 0, -1, 1};
+    static const int DY[4] = {-1, 1, 0, 0};
+    static const char KEY[4] = {'w', 's', 'a', 'd'};
+    int best = dist[y * map->cols + x];
+    int key = 0;
+    for (int d = 0; d < 4; d++) {
+        int nx = x + DX[d], ny = y + DY[d];
+        if (nx < 0 || ny < 0 || nx >= map->cols || ny >= map->rows) continue;
+        ent_t* there = map->at(nx, ny);
+        if (there != nullptr && there->cprint() >= 'A' && there->cprint() <= 'Z') continue;  // someone's there
+        if (dist[ny * map->cols + nx] < best) {
+            best = dist[ny * map->cols + nx];
+            key = KEY[d];
+        }
+    }
+    return key;
+}
+
+/*
+ * class_identifier: threat map - for every cell, how many '!' holders have a clear shot at it
+ *                   (the same row/column rule the u/h/j/k attacks use: up to and including the first
+ *                   obstacle or player), plus how far the cell is from the storm edge
+ *                   each armed player keeps 4 rays; a move, pickup or death recasts that player's rays
+ *                   and a blocker appearing or vanishing only recasts the rays that cover the cell,
+ *                   found through per-row and per-column lists of armed players
+ * constructors: threatmap_t()
+ * public functions:    void init(map_t*, player_t*, const inventory_t* armed, int count)
+ *                      void sync()
+ *                      void playerMoved(int pid)
+ *                      void cellChanged(int x, int y)
+ *                      int lines(int x, int y) const
+ *                      int stormDistance(int x, int y) const
+ * static members: none
+ */
+
+class threatmap_t {
+public:
+    threatmap_t() {map = nullptr; players = nullptr; armed = nullptr; count = 0;}
+    void init(map_t* m, player_t* p, const inventory_t* isArmed, int pcount);
+    void sync();                        // picks up players who got a '!' or died
+    void playerMoved(int pid);
+    void cellChanged(int x, int y);     // a blocker appeared or vanished here
+    int lines(int x, int y) const {return threat[y * map->cols + x];}
+    int stormDistance(int x, int y) const;  // steps to the storm edge, negative inside the storm
+private:
+    struct shooter_t {
+        bool active;
+        int ox, oy;                     // where the rays were cast from
+        int len[4];                     // cells covered up, down, left, right
+    };
+    void add(int pid);
+    void remove(int pid);
+    void castRay(int pid, int d);
+    void clearRay(int pid, int d);
+    bool blocks(int x, int y) const;
+    map_t* map;
+    player_t* players;
+    const inventory_t* armed;           // the world's player inventories, armed means a '!' in SLOT_LONG
+    int count;
+    vector<unsigned short> threat;
+    vector<shooter_t> shooters;
+    vector<vector<int> > rowArmed;      // armed players by the row they stand in
+    vector<vector<int> > colArmed;
+};
+
+static const int RAY_DX[4] = {0, 0, -1, 1};     // up, down, left, right
+static const int RAY_DY[4] = {-1, 1, 0, 0};
+
+void threatmap_t::init(map_t* m, player_t* p, const inventory_t* isArmed, int pcount) {
+    map = m;
+    players = p;
+    armed = isArmed;
+    count = pcount;
+    threat.assign(m->rows * m->cols, 0);
+    shooters.assign(pcount, shooter_t());
+    rowArmed.assign(m->rows, vector<int>());
+    colArmed.assign(m->cols, vector<int>());
+    for (int i = 0; i < pcount; i++) shooters[i].active = false;
+    sync();
+}
+
+bool threatmap_t::blocks(int x, int y) const {
+    ent_t* ent = map->at(x, y);
+    if (ent == nullptr) return false;
+    char c = ent->cprint();
+    return c == '@' || (c >= 'A' && c <= 'Z');
+}
+
+int threatmap_t::stormDistance(int x, int y) const {
+    const coord_t& c = map->centerCoord;
+    int d = x - (c.x - map->dXL);                       // the safe zone is what the storm hasn't taken
+    if ((c.x + map->dXR) - x < d) d = (c.x + map->dXR) - x;
+    if (y - (c.y - map->dYU) < d) d = y - (c.y - map->dYU);
+    if ((c.y + map->dYB) - y < d) d = (c.y + map->dYB) - y;
+    return d;
+}
+
+void threatmap_t::sync() {
+    for (int i = 0; i < count; i++) {
+        bool shouldBe = armed[i].has(SLOT_LONG) && players[i].playerStatus[i] == ALIVE;
+        if (shouldBe && !shooters[i].active) add(i);
+        else if (!shouldBe && shooters[i].active) remove(i);
+    }
+}
+
+void threatmap_t::playerMoved(int pid) {
+    if (map == nullptr || !shooters[pid].active) return;
+    remove(pid);
+    add(pid);
+}
+
+void threatmap_t::add(int pid) {
+    shooter_t& s = shooters[pid];
+    s.active = true;
+    s.ox = players[pid].pos().x;
+    s.oy = players[pid].pos().y;
+    rowArmed[s.oy].push_back(pid);
+    colArmed[s.ox].push_back(pid);
+    for (int d = 0; d < 4; d++) castRay(pid, d);
+}
+
+void threatmap_t::remove(int pid) {
+    shooter_t& s = shooters[pid];
+    for (int d = 0; d < 4; d++) clearRay(pid, d);
+    vector<int>* lists[2] = {&rowArmed[s.oy], &colArmed[s.ox]};
+    for (int l = 0; l < 2; l++) {
+        vector<int>& v = *lists[l];
+        for (size_t i = 0; i < v.size(); i++) {
+            if (v[i] == pid) {v[i] = v.back(); v.pop_back(); break;}
+        }
+    }
+    s.active = false;
+}
+
+void threatmap_t::castRay(int pid, int d) {
+    shooter_t& s = shooters[pid];
+    s.len[d] = 0;
+    int x = s.ox + RAY_DX[d], y = s.oy + RAY_DY[d];
+    while (x >= 0 && y >= 0 && x < map->cols && y < map->rows) {
+        threat[y * map->cols + x]++;
+        s.len[d]++;
+        if (blocks(x, y)) break;                        // the shot stops on whoever it hits
+        x += RAY_DX[d];
+        y += RAY_DY[d];
+    }
+}
+
+void threatmap_t::clearRay(int pid, int d) {
+    shooter_t& s = shooters[pid];
+    for (int i = 1; i <= s.len[d]; i++) threat[(s.oy + RAY_DY[d] * i) * map->cols + (s.ox + RAY_DX[d] * i)]--;
+    s.len[d] = 0;
+}
+
+void threatmap_t::cellChanged(int x, int y) {
+    if (map == nullptr) return;
+    vector<int>& row = rowArmed[y];
+    for (size_t i = 0; i < row.size(); i++) {
+        int pid = row[i];
+        int dx = x - shooters[pid].ox;
+        int d = dx < 0 ? 2 : 3;
+        if (dx != 0 && abs(dx) <= shooters[pid].len[d]) {clearRay(pid, d); castRay(pid, d);}
+    }
+    vector<int>& col = colArmed[x];
+    for (size_t i = 0; i < col.size(); i++) {
+        int pid = col[i];
+        int dy = y - shooters[pid].oy;
+        int d = dy < 0 ? 0 : 1;
+        if (dy != 0 && abs(dy) <= shooters[pid].len[d]) {clearRay(pid, d); castRay(pid, d);}
+    }
+}
+
+/*
+ * class_identifier: the whole map squeezed into a few terminal cells. the map is cut into square tiles,
+ *                   each keeping a count per layer (players, '@', weapons, storm). a write only marks its
+ *                   tile, dirty tiles are recounted right before a draw, and a summed-area table over the
+ *                   tile grid then gives the counts of any block of tiles in four lookups, so a minimap
+ *                   cell costs the same however much of the map it covers
+ * constructors: minimap_t()
+ * public functions:    void init(map_t* m)
+ *                      void cellChanged(int x, int y)
+ *                      void draw(vector<char>& out, int w, int h, int vx, int vy, bool everyone)
+ * static members: none
+ */
+
+const int MINI_PLAYERS = 0;
+const int MINI_WALLS = 1;
+const int MINI_WEAPONS = 2;
+const int MINI_STORM = 3;
+const int MINI_LAYERS = 4;
+const int MINI_MAX_TILES = 256;     // per axis, keeps the tables small on huge maps
+const int MINI_COLS = 32;           // largest minimap the local game draws
+const int MINI_ROWS = 12;
+
+class minimap_t {
+public:
+    minimap_t() {map = nullptr; tile = 1; tilesX = tilesY = 0; stale = false;}
+    void init(map_t* m);
+    void cellChanged(int x, int y);
+    void draw(vector<char>& out, int w, int h, int vx, int vy, bool everyone);
+private:
+    void recount(int t);
+    void rebuild();
+    long long sum(int layer, int tx0, int ty0, int tx1, int ty1) const;     // tiles [tx0,tx1) x [ty0,ty1)
+    map_t* map;
+    int tile;                               // cells per tile side
+    int tilesX;
+    int tilesY;
+    vector<int> counts[MINI_LAYERS];        // per tile
+    vector<long long> sat[MINI_LAYERS];     // (tilesX+1) x (tilesY+1), row and column 0 are zero
+    vector<int> dirty;                      // tiles written since the last draw
+    vector<unsigned char> dirtyFlag;
+    bool stale;                             // a tile changed, the tables need rebuilding
+};
+
+void minimap_t::init(map_t* m) {
+    map = m;
+    tile = std::max(1, (std::max(m->cols, m->rows) + MINI_MAX_TILES - 1) / MINI_MAX_TILES);
+    tilesX = (m->cols + tile - 1) / tile;
+    tilesY = (m->rows + tile - 1) / tile;
+    for (int l = 0; l < MINI_LAYERS; l++) {
+        counts[l].assign(tilesX * tilesY, 0);
+        sat[l].assign((tilesX + 1) * (tilesY + 1), 0);
+    }
+    dirty.clear();
+    dirtyFlag.assign(tilesX * tilesY, 0);
+    for (int t = 0; t < tilesX * tilesY; t++) recount(t);
+    stale = true;
+}
+
+void minimap_t::cellChanged(int x, int y) {
+    int t = (y / tile) * tilesX + x / tile;
+    if (dirtyFlag[t]) return;
+    dirtyFlag[t] = 1;
+    dirty.push_back(t);
+}
+
+void minimap_t::recount(int t) {
+    int tx = t % tilesX, ty = t / tilesX;
+    int n[MINI_LAYERS] = {0};
+    for (int y = ty * tile; y < std::min(map->rows, (ty + 1) * tile); y++) {
+        for (int x = tx * tile; x < std::min(map->cols, (tx + 1) * tile); x++) {
+            char c = map->glyphAt(x, y);
+            if (c >= 'A' && c < 'A' + PLAYERCNT) n[MINI_PLAYERS]++;
+            else if (c == '@') n[MINI_WALLS]++;
+            else if (c == '#' || c == '!') n[MINI_WEAPONS]++;
+            else if (c == 's') n[MINI_STORM]++;
+        }
+    }
+    for (int l = 0; l < MINI_LAYERS; l++) counts[l][t] = n[l];
+}
+
+// recounts the dirty tiles, then redoes the tables if anything changed
+void minimap_t::rebuild() {
+    for (size_t i = 0; i < dirty.size(); i++) {
+        recount(dirty[i]);
+        dirtyFlag[dirty[i]] = 0;
+    }
+    stale = stale || !dirty.empty();
+    dirty.clear();
+    if (!stale) return;
+    int w = tilesX + 1;
+    for (int l = 0; l < MINI_LAYERS; l++) {
+        for (int ty = 0; ty < tilesY; ty++) {
+            long long row = 0;
+            for (int tx = 0; tx < tilesX; tx++) {
+                row += counts[l][ty * tilesX + tx];
+                sat[l][(ty + 1) * w + tx + 1] = sat[l][ty * w + tx + 1] + row;
+            }
+        }
+    }
+    stale = false;
+}
+
+long long minimap_t::sum(int layer, int tx0, int ty0, int tx1, int ty1) const {
+    int w = tilesX + 1;
+    const vector<long long>& s = sat[layer];
+    return s[ty1 * w + tx1] - s[ty0 * w + tx1] - s[ty1 * w + tx0] + s[ty0 * w + tx0];
+}
+
+/*
+ * function_identifier: fills a w x h minimap, row by row. each minimap cell covers a block of tiles:
+ *                      the viewer's own letter where it stands, '+' for players (only if everyone is
+ *                      true, it's a spectator's view), 's' where the storm holds most of the block,
+ *                      '#' for weapons, '@' for thick obstacles and ':' for scattered ones
+ * parameters: output, size, the viewer's cell (-1 for none), whether other players show
+ * return value: none
+ */
+void minimap_t::draw(vector<char>& out, int w, int h, int vx, int vy, bool everyone) {
+    rebuild();
+    out.assign(w * h, ' ');
+    for (int my = 0; my < h; my++) {
+        int ty0 = tilesY * my / h, ty1 = std::max(ty0 + 1, tilesY * (my + 1) / h);
+        for (int mx = 0; mx < w; mx++) {
+            int tx0 = tilesX * mx / w, tx1 = std::max(tx0 + 1, tilesX * (mx + 1) / w);
+            long long area = (long long)(tx1 - tx0) * (ty1 - ty0) * tile * tile;
+            char& c = out[my * w + mx];
+            if (vx >= tx0 * tile && vx < tx1 * tile && vy >= ty0 * tile && vy < ty1 * tile) c = map->glyphAt(vx, vy);
+            else if (everyone && sum(MINI_PLAYERS, tx0, ty0, tx1, ty1) > 0) c = '+';
+            else if (2 * sum(MINI_STORM, tx0, ty0, tx1, ty1) >= area) c = 's';
+            else if (sum(MINI_WEAPONS, tx0, ty0, tx1, ty1) > 0) c = '#';
+            else if (long long walls = sum(MINI_WALLS, tx0, ty0, tx1, ty1)) c = 8 * walls >= area ? '@' : ':';
+        }
+    }
+}
+
+const int REWIND_TICKS = 1024;      // how far back the local game can rewind
+
+/*
+ * class_identifier: rewind buffer - a ring holding the last N ticks as lists of what changed: every
+ *                   grid write (what the cell held before and after) and every player or obstacle row
+ *                   whose position, hp or alive flag differs from the end of the tick before, plus the
+ *                   storm's extent, tick and round the tick started from. grid writes come in from
+ *                   map_t::cellWritten() as they happen, the rows are found at endTick() by comparing the
+ *                   columns against a shadow copy, so a tick's record costs what changed in it.
+ *                   undo() plays the newest record backwards through setCell(), so every observer
+ *                   (fov, flow, threat, minimap, hash) follows. timers, inventories, shots in flight and
+ *                   NPC scripts aren't recorded, they carry on from where they are
+ * constructors: rewind_t(int ticks)
+ * public functions:    void start(map_t* m, world_t* w, unsigned int tick, int round)
+ *                      void cellChanged(int cell, ent_t* was, ent_t* now)
+ *                      void endTick(unsigned int tick, int round)
+ *                      bool undo(unsigned int& tick, int& round)
+ *                      int depth() const
+ * static members: none
+ */
+
+class rewind_t {
+public:
+    explicit rewind_t(int ticks) : records(ticks) {map = nullptr; world = nullptr; newest = -1; count = 0; replaying = false;}
+    void start(map_t* m, world_t* w, unsigned int tick, int round);    // begins recording, m->journal = this
+    void cellChanged(int cell, ent_t* was, ent_t* now);
+    void endTick(unsigned int tick, int round);     // closes the open record, skipped if nothing changed
+    bool undo(unsigned int& tick, int& round);      // back to the start of the newest tick, false if there's none
+    int depth() const {return count;}               // ticks undo() can still go back
+private:
+    struct cellchange_t {
+        int cell;
+        ent_t* was;
+        ent_t* now;
+    };
+    struct rowchange_t {
+        int arch;
+        int row;
+        coord_t pos[2];             // before, after
+        int hp[2];
+        bool alive[2];
+    };
+    struct record_t {
+        unsigned int tick;          // where the tick started
+        int round;
+        int storm[5];               // dXR, dXL, dYU, dYB, radius
+        vector<cellchange_t> cells; // in the order they were written
+        vector<rowchange_t> rows;
+    };
+    void open(unsigned int tick, int round);
+    map_t* map;
+    world_t* world;
+    vector<record_t> records;       // the ring, cleared records keep their capacity
+    record_t current;               // the tick being recorded
+    int newest;
+    int count;
+    bool replaying;                 // undo()'s own writes aren't recorded
+    vector<coord_t> shadowPos[2];   // players, obstacles as of the last endTick()
+    vector<int> shadowHp[2];
+    vector<bool> shadowAlive[2];
+};
+
+static const int REWIND_ARCHES[2] = {ARCH_PLAYER, ARCH_OBSTACLE};
+
+void rewind_t::start(map_t* m, world_t* w, unsigned int tick, int round) {
+    map = m;
+    world = w;
+    map->journal = this;
+    newest = -1;
+    count = 0;
+    for (int a = 0; a < 2; a++) {
+        int n = world->count(REWIND_ARCHES[a]);
+        shadowPos[a].assign(world->pos(REWIND_ARCHES[a]), world->pos(REWIND_ARCHES[a]) + n);
+        shadowHp[a].resize(n);
+        shadowAlive[a].resize(n);
+        for (int i = 0; i < n; i++) {
+            shadowHp[a][i] = world->hp(REWIND_ARCHES[a])[i].gethp();
+            shadowAlive[a][i] = world->alive(REWIND_ARCHES[a])[i];
+        }
+    }
+    open(tick, round);
+}
+
+void rewind_t::open(unsigned int tick, int round) {
+    current.tick = tick;
+    current.round = round;
+    current.storm[0] = map->dXR;
+    current.storm[1] = map->dXL;
+    current.storm[2] = map->dYU;
+    current.storm[3] = map->dYB;
+    current.storm[4] = map->radius;
+    current.cells.clear();
+    current.rows.clear();
+}
+
+void rewind_t::cellChanged(int cell, ent_t* was, ent_t* now) {
+    if (replaying || was == now) return;
+    cellchange_t c = {cell, was, now};
+    current.cells.push_back(c);
+}
+
+void rewind_t::endTick(unsigned int tick, int round) {
+    if (map == nullptr) return;
+    for (int a = 0; a < 2; a++) {
+        int arch = REWIND_ARCHES[a];
+        const coord_t* pos = world->pos(arch);
+        health_t* hp = world->hp(arch);
+        const bool* alive = world->alive(arch);
+        for (int i = 0; i < (int)shadowPos[a].size(); i++) {
+            int h = hp[i].gethp();
+            if (pos[i].x == shadowPos[a][i].x && pos[i].y == shadowPos[a][i].y && h == shadowHp[a][i]
+                && alive[i] == shadowAlive[a][i]) continue;
+            rowchange_t r = {arch, i, {shadowPos[a][i], pos[i]}, {shadowHp[a][i], h}, {shadowAlive[a][i], alive[i]}};
+            current.rows.push_back(r);
+            shadowPos[a][i] = pos[i];
+            shadowHp[a][i] = h;
+            shadowAlive[a][i] = alive[i];
+        }
+    }
+    if (current.cells.empty() && current.rows.empty() && current.tick == tick && current.round == round) return;
+    newest = (newest + 1) % records.size();
+    swap(records[newest], current);             // the ring slot's old vectors become the next open record
+    count = std::min(count + 1, (int)records.size());
+    open(tick, round);
+}
+
+bool rewind_t::undo(unsigned int& tick, int& round) {
+    if (map == nullptr) return false;
+    endTick(tick, round);                       // whatever happened since the last endTick() goes first
+    if (count == 0) return false;
+    record_t& r = records[newest];
+    replaying = true;
+    for (size_t i = r.cells.size(); i-- > 0; )
+        map->setCell(r.cells[i].cell % map->cols, r.cells[i].cell / map->cols, r.cells[i].was);
+    replaying = false;
+    for (size_t i = r.rows.size(); i-- > 0; ) {
+        const rowchange_t& c = r.rows[i];
+        int a = c.arch == ARCH_PLAYER ? 0 : 1;
+        world->pos(c.arch)[c.row] = shadowPos[a][c.row] = c.pos[0];
+        world->hp(c.arch)[c.row].sethp(shadowHp[a][c.row] = c.hp[0]);
+        world->alive(c.arch)[c.row] = shadowAlive[a][c.row] = c.alive[0];
+        if (c.arch == ARCH_PLAYER && (c.pos[0].x != c.pos[1].x || c.pos[0].y != c.pos[1].y)) {
+            if (map->fov != nullptr) map->fov->playerMoved(c.row);
+            if (map->threat != nullptr) map->threat->playerMoved(c.row);
+        }
+    }
+    map->dXR = r.storm[0];
+    map->dXL = r.storm[1];
+    map->dYU = r.storm[2];
+    map->dYB = r.storm[3];
+    map->radius = r.storm[4];
+    tick = r.tick;
+    round = r.round;
+    newest = (newest + records.size() - 1) % records.size();
+    count--;
+    open(tick, round);
+    return true;
+}
+
+/*
+ * function_identifier: writes an entity into a cell, records it as changed when tracking is on
+ *                      and tells the fov and flow field when opacity flips, and the threat map
+ *                      when something that stops a shot comes or goes. writes outside of the grid are ignored
+ * parameters: x, y, entity pointer (nullptr for nothing)
+ * return value: none
+ */
+void map_t::setCell(int x, int y, ent_t* ent) {
+    if (x < 0 || y < 0 || x >= cols || y >= rows) return;
+    ent_t* was = egrid[y][x];
+    cellWritten(x, y, writeCell(x, y, ent), was);
+}
+
+/*
+ * function_identifier: the egrid half of setCell(), touches nothing but the cell itself so storm bands
+ *                      can run it side by side on disjoint cells and send the notifications afterwards
+ * parameters: cell on the grid, new entity
+ * return value: CELL_FLIP_OPAQUE if sight/paths changed, CELL_FLIP_BLOCKER if shots changed,
+ *               CELL_FLIP_GLYPH and the old glyph if the cell looks different
+ */
+int map_t::writeCell(int x, int y, ent_t* ent) {
+    bool wasOpaque = isOpaque(x, y);
+    char wasGlyph = glyphAt(x, y);
+    egrid[y][x] = ent;
+    char glyph = glyphAt(x, y);
+    bool wasBlocking = wasGlyph == '@' || (wasGlyph >= 'A' && wasGlyph <= 'Z');
+    bool blocking = glyph == '@' || (glyph >= 'A' && glyph <= 'Z');
+    return (wasOpaque != isOpaque(x, y) ? CELL_FLIP_OPAQUE : 0) | (wasBlocking != blocking ? CELL_FLIP_BLOCKER : 0)
+         | (wasGlyph != glyph ? CELL_FLIP_GLYPH | (unsigned char)wasGlyph << CELL_OLD_GLYPH_SHIFT : 0);
+}
+
+void map_t::cellWritten(int x, int y, int flips, ent_t* was) {
+    if (!changedFlag.empty() && !changedFlag[y * cols + x]) {
+        changedFlag[y * cols + x] = 1;
+        changed.push_back(y * cols + x);
+    }
+    if (flips & CELL_FLIP_GLYPH) {
+        char old = (char)(flips >> CELL_OLD_GLYPH_SHIFT), now = glyphAt(x, y);
+        hash ^= zobristKey(y * cols + x, old) ^ zobristKey(y * cols + x, now);
+        check ^= zobristKey(y * cols + x, old, ZOBRIST_CHECK_SALT) ^ zobristKey(y * cols + x, now, ZOBRIST_CHECK_SALT);
+    }
+    if (flips & CELL_FLIP_OPAQUE) {
+        if (fov != nullptr) fov->cellChanged(x, y);
+        if (flow != nullptr) flow->cellChanged(x, y);
+    }
+    if ((flips & CELL_FLIP_BLOCKER) && threat != nullptr) threat->cellChanged(x, y);
+    if (minimap != nullptr) minimap->cellChanged(x, y);
+    if (journal != nullptr) journal->cellChanged(y * cols + x, was, egrid[y][x]);
+}
+
+// prints the grid, hiding whatever viewer can't see (the storm is always visible)
+void map_t::dynamicPrint() {
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) printw("%c", shownAt(j, i));
+        printw("\n");
+    }
+}
+
+char map_t::shownAt(int x, int y) {
+    bool fogged = fov != nullptr && viewer >= 0 && !fov->canSee(viewer, x, y);
+    if (egrid[y][x] != nullptr && (!fogged || egrid[y][x] == this)) return egrid[y][x]->cprint();
+    return ' ';
+}
+
+void map_t::snapshot(vector<char>& out, int x0, int y0, int w, int h) {
+    out.resize(w * h);
+    for (int i = 0; i < h; i++)
+        for (int j = 0; j < w; j++) out[i * w + j] = shownAt(x0 + j, y0 + i);
+}
+
+void updatePos(map_t &map, player_t &p, coord_t from){
+    map.setCell(from.x, from.y, leftBehind(map, from.x, from.y));
+    map.setCell(p.pos().x, p.pos().y, &p);
+    if (map.fov != nullptr) map.fov->playerMoved(p.getPid());
+    if (map.threat != nullptr) map.threat->playerMoved(p.getPid());
+}
+
+// one row per movement key, makemove() looks the key up instead of walking an if-chain
+struct step_t {
+    int key;
+    int dx;
+    int dy;
+    void (player_t::*move)();
+};
+
+const step_t STEPS[4] = {
+    {'w', 0, -1, &player_t::moveUp},
+    {'s', 0, 1, &player_t::moveDown},
+    {'d', 1, 0, &player_t::moveRight},
+    {'a', -1, 0, &player_t::moveLeft},
+};
+
+// key -> row of STEPS, -1 for keys that don't move
+struct stepindex_t {
+    signed char row[128];
+    stepindex_t() {
+        for (int i = 0; i < 128; i++) row[i] = -1;
+        for (int i = 0; i < 4; i++) row[STEPS[i].key] = i;
+    }
+    int operator[](int key) const {return row[key];}
+};
+const stepindex_t STEP_INDEX;
+
+/*
+ * function_identifier: moves player on map, depending on key user has pressed
+ *                      (attacks are queued and resolved later by combat_t, pickups are the match's)
+ * parameters: map_t &map, player_t *players, int pid, obstacle_t*o, int direction
+ * return value: none
+ */
+void makemove(map_t &map, player_t *players, int pid, obstacle_t*o, int direction) {
+#ifdef curses
+    if (direction < 0 || direction >= 128 || STEP_INDEX[direction] < 0) return;   // not a move key
+    const step_t &step = STEPS[STEP_INDEX[direction]];
+    player_t &p = players[pid];                                         // the player making the move
+    int tx = p.pos().x + step.dx;
+    int ty = p.pos().y + step.dy;
+    bool obstacle = false;
+    bool player = false;
+
+    if (tx < 0 || ty < 0 || tx >= map.cols || ty >= map.rows) {         // prevent going out of bounds
+        return;
+    }
+    ent_t* target = map.at(tx, ty);
+    for (int i = 0; i < NUM_OF_OBSTACLES; i++){                         // looking at obstacles around
+        if (target == (o+i)) {
+            obstacle = true;
+        }
+    }
+    for (int i = 0; i< PLAYERCNT; i++) {                                // looking around for players
+        if (target == (players+i)) {
+            player = true;
+        }
+    }
+
+    if (!obstacle && !player) {                                         // if no player or obstacle
+        coord_t from = p.pos();
+        (p.*step.move)();                                               // move player
+        updatePos(map, p, from);                                        // update player's position
+    }
+#endif
+}
+
+const int STORM_DAMAGE_PER_DEPTH = 1;   // hp a player loses per tick for every cell it is inside the storm
+
+/*
+ * function_identifier: storm system, damage over time. a player depth cells inside the storm loses
+ *                      depth * STORM_DAMAGE_PER_DEPTH hp every tick and dies once its hp drops below zero.
+ *                      two straight passes over rows first..last-1, one turning the position column into
+ *                      depths against the safe zone, one taking the damage off the hp column and clearing
+ *                      the alive flags, neither branches per player. the rows that died are packed into
+ *                      dead[first..] afterwards, so bands can run it side by side
+ * parameters: world, archetype (needs COMP_POS, COMP_HP and COMP_ALIVE), the safe zone's edges
+ *             (inclusive), row range, depth scratch and the death list, both indexed by row
+ * return value: how many rows died, they are dead[first] onwards
+ */
+int stormSystem(world_t& world, int arch, int left, int right, int top, int bottom, int first, int last, int* depth, int* dead) {
+    const coord_t* pos = world.pos(arch);
+    health_t* hp = world.hp(arch);
+    bool* alive = world.alive(arch);
+    for (int i = first; i < last; i++) {
+        int d = std::max(left - pos[i].x, pos[i].x - right);
+        d = std::max(d, std::max(top - pos[i].y, pos[i].y - bottom));
+        depth[i] = std::max(d, 0);
+    }
+    int n = first;
+    for (int i = first; i < last; i++) {
+        int h = hp[i].gethp() - alive[i] * depth[i] * STORM_DAMAGE_PER_DEPTH;
+        bool died = alive[i] & (h < 0);
+        hp[i].sethp(h);
+        alive[i] = alive[i] & !died;
+        dead[n] = i;                    // always written, only kept if it died
+        n += died;
+    }
+    return n - first;
+}
+
+const int SHORT_RANGE_DMG = 20;     // '#' hit, a full-health target survives the first one
+const int LONG_RANGE_DMG = 1000;    // '!' hit, always lethal
+const int SHORT_MAG = 10;           // rounds in a '#' magazine, a fresh one comes with two spare magazines
+const int LONG_MAG = 3;             // rounds in a '!' magazine, likewise
+
+// the weapon a pickup row holds when it (re)appears on the grid
+weapon_t groundWeapon(int item) {
+    if (item < NUM_SHORT_WEPS) return weapon_t(SHORT_MAG, SHORT_MAG, 2 * SHORT_MAG, SHORT_RANGE_DMG, "short range");
+    return weapon_t(LONG_MAG, LONG_MAG, 2 * LONG_MAG, LONG_RANGE_DMG, "long range");
+}
+
+const int PROJECTILE_SPEED = 4;     // cells a '!' shot travels per tick
+const int PROJECTILE_RANGE = 16 * PROJECTILE_SPEED;    // cells before it falls out of the air
+const int PROJECTILE_POOL = 1024;   // shots a match can have in flight, more are dropped
+
+// what an attack striking ent would damage: obstacle rows are 0..NUM_OF_OBSTACLES-1, player rows follow
+// them, -1 if it can't be hit (walls, pickups, storm, blanks)
+int hitIndex(const ent_t* ent, const world_t& world) {
+    if (ent == nullptr || ent->getWorld() != &world) return -1;
+    if (ent->getArch() == ARCH_OBSTACLE) return ent->getRow();
+    if (ent->getArch() == ARCH_PLAYER) return NUM_OF_OBSTACLES + ent->getRow();
+    return -1;
+}
+
+/*
+ * class_identifier: long range shots in flight, one array per field. advance() moves every shot one
+ *                   cell at a time for PROJECTILE_SPEED cells: a straight pass over the position arrays,
+ *                   a pass that masks shots off the grid or out of range, then the grid lookups for the
+ *                   survivors. shots that hit something or expire are swap-removed, and the arrays are
+ *                   sized once, so nothing is allocated while the match runs
+ * constructors: projectiles_t(int capacity)
+ * public functions:    bool fire(int x, int y, int dx, int dy, int dmg)
+ *                      void advance(map_t& map, const world_t& world)
+ *                      const vector<pair<int, int> >& struck() const
+ *                      int count() const
+ * static members: none
+ */
+
+class projectiles_t {
+public:
+    explicit projectiles_t(int capacity);
+    bool fire(int x, int y, int dx, int dy, int dmg);   // false if the pool is full
+    void advance(map_t& map, const world_t& world);
+    const vector<pair<int, int> >& struck() const {return hits;}  // (hitIndex(), damage) of everything hit by advance()
+    int count() const {return n;}
+private:
+    void remove(int i);
+    int n;
+    vector<int> x;
+    vector<int> y;
+    vector<int> dx;
+    vector<int> dy;
+    vector<int> range;              // cells left
+    vector<int> dmg;                // the shooter's weapon damage when it fired
+    vector<unsigned char> gone;     // per sub-step, off the grid or out of range
+    vector<pair<int, int> > hits;
+};
+
+projectiles_t::projectiles_t(int capacity) : x(capacity), y(capacity), dx(capacity), dy(capacity),
+                                             range(capacity), dmg(capacity), gone(capacity) {
+    n = 0;
+    hits.reserve(capacity);
+}
+
+bool projectiles_t::fire(int sx, int sy, int sdx, int sdy, int damage) {
+    if (n == (int)x.size()) return false;
+    x[n] = sx;
+    y[n] = sy;
+    dx[n] = sdx;
+    dy[n] = sdy;
+    range[n] = PROJECTILE_RANGE;
+    dmg[n] = damage;
+    n++;
+    return true;
+}
+
+// the last shot takes i's place, order doesn't matter
+void projectiles_t::remove(int i) {
+    n--;
+    x[i] = x[n];
+    y[i] = y[n];
+    dx[i] = dx[n];
+    dy[i] = dy[n];
+    range[i] = range[n];
+    dmg[i] = dmg[n];
+}
+
+/*
+ * function_identifier: one tick of flight. a shot stops at the first obstacle or player it enters (which
+ *                      goes into struck()) or at anything else opaque, such as an authored wall
+ * parameters: the grid, the world its entities live in
+ * return value: none
+ */
+void projectiles_t::advance(map_t& map, const world_t& world) {
+    hits.clear();
+    unsigned cols = map.cols, rows = map.rows;
+    for (int step = 0; step < PROJECTILE_SPEED && n > 0; step++) {
+        int* px = x.data();
+        int* py = y.data();
+        const int* pdx = dx.data();
+        const int* pdy = dy.data();
+        unsigned char* pg = gone.data();
+        for (int i = 0; i < n; i++) {               // no branches, the compiler can vectorize it
+            px[i] += pdx[i];
+            py[i] += pdy[i];
+            pg[i] = ((unsigned)px[i] >= cols) | ((unsigned)py[i] >= rows);
+        }
+        for (int i = n - 1; i >= 0; i--) {          // backwards, so swap-removing keeps the rest in place
+            if (pg[i]) {
+                remove(i);
+                continue;
+            }
+            ent_t* cell = map.egrid[py[i]][px[i]];
+            if (cell == nullptr) continue;
+            int idx = hitIndex(cell, world);
+            if (idx >= 0) hits.push_back(make_pair(idx, dmg[i]));
+            if (idx >= 0 || map.isOpaque(px[i], py[i])) remove(i);     // authored walls soak the shot
+        }
+    }
+    for (int i = n - 1; i >= 0; i--) {              // PROJECTILE_RANGE is a whole number of ticks
+        range[i] -= PROJECTILE_SPEED;
+        if (range[i] <= 0) remove(i);
+    }
+}
+
+/*
+ * class_identifier: combat phase of a tick. attacks ('f', 'u', 'h', 'j', 'k') are only queued while
+ *                   the tick runs; resolve() then finds every target against the same grid, sums the
+ *                   damage per entity in one buffer and commits deaths and grid changes together,
+ *                   so simultaneous attacks don't depend on who pressed first
+ *                   long range attacks become projectiles that fly PROJECTILE_SPEED cells per resolve()
+ *                   entity index: see hitIndex()
+ * constructors: combat_t()
+ * public functions:    void queue(int pid, int key)
+ *                      void resolve(map_t&, world_t&)
+ *                      int pending() const
+ *                      int inFlight() const
+ *                      const vector<pair<int, bool> >& killed() const
+ *                      const vector<pair<int, int> >& hurt() const
+ *                      static bool isAttack(int key)
+ * static members: none
+ */
+
+class combat_t {
+public:
+    combat_t();
+    void queue(int pid, int key) {intents.push_back(make_pair(pid, key));}
+    void resolve(map_t &map, world_t &world);
+    int pending() const {return intents.size();}
+    int inFlight() const {return shots.count();}
+    const vector<pair<int, bool> >& killed() const {return deaths;}    // (pid, by a long range hit) last resolve()
+    const vector<pair<int, int> >& hurt() const {return wounds;}       // (pid, hp lost) last resolve()
+    static bool isAttack(int key) {return key == 'f' || key == 'u' || key == 'h' || key == 'j' || key == 'k';}
+private:
+    void hit(int idx, int dmg);
+    vector<pair<int, int> > intents;    // (pid, key) in the order they came in
+    vector<int> damage;                 // accumulated per entity index this tick
+    vector<int> touched;                // entity indices with damage, so the commit skips the rest
+    vector<pair<int, bool> > deaths;
+    vector<pair<int, int> > wounds;
+    projectiles_t shots;                // '!' shots still flying
+};
+
+combat_t::combat_t() : shots(PROJECTILE_POOL) {
+    damage.assign(NUM_OF_OBSTACLES + PLAYERCNT, 0);
+}
+
+void combat_t::hit(int idx, int dmg) {
+    if (idx < 0) return;
+    if (damage[idx] == 0) touched.push_back(idx);
+    damage[idx] += dmg;
+}
+
+/*
+ * function_identifier: resolves every queued attack in one pass, then applies the results
+ *                      an entity dies once its hp drops below zero, which keeps the old rules:
+ *                      two '#' hits or one '!' hit
+ *                      the damage comes from the attacker's weapon, '!' shots carry it while they fly
+ *                      '!' shots are launched here and every shot in flight moves on before the commit
+ *                      the commit reads and writes the hp, alive and position columns directly
+ * parameters: map_t &map, world_t &world
+ * return value: none
+ */
+void combat_t::resolve(map_t &map, world_t &world) {
+    deaths.clear();
+    wounds.clear();
+    if (intents.empty() && shots.count() == 0) return;
+    static const int DX[4] = {0, 0, -1, 1};             // up, down, left, right
+    static const int DY[4] = {-1, 1, 0, 0};
+
+    // gather - nothing on the grid changes until every attack has picked its target
+    for (size_t i = 0; i < intents.size(); i++) {
+        const coord_t &shooter = world.pos(ARCH_PLAYER)[intents[i].first];
+        const inventory_t &inv = world.inventories(ARCH_PLAYER)[intents[i].first];
+        int x = shooter.x;
+        int y = shooter.y;
+        int key = intents[i].second;
+        if (key == 'f') {                               // nearest obstacle and nearest player next to us
+            bool hitObstacle = false, hitPlayer = false;
+            for (int d = 0; d < 4; d++) {
+                int idx = hitIndex(map.at(x + DX[d], y + DY[d]), world);
+                if (idx < 0) continue;
+                bool isObstacle = idx < NUM_OF_OBSTACLES;
+                if (isObstacle && !hitObstacle) {hit(idx, inv.get(SLOT_SHORT).getDmg()); hitObstacle = true;}
+                if (!isObstacle && !hitPlayer) {hit(idx, inv.get(SLOT_SHORT).getDmg()); hitPlayer = true;}
+            }
+        } else {                                        // a shot flying down the line
+            int d = key == 'u' ? 0 : key == 'j' ? 1 : key == 'h' ? 2 : 3;
+            shots.fire(x, y, DX[d], DY[d], inv.get(SLOT_LONG).getDmg());
+        }
+    }
+    intents.clear();
+    shots.advance(map, world);                          // this tick's shots get their first stretch too
+    const vector<pair<int, int> >& struck = shots.struck();
+    for (size_t i = 0; i < struck.size(); i++) hit(struck[i].first, struck[i].second);
+
+    // commit - hp, deaths and grid writes, in entity order so the result is deterministic
+    sort(touched.begin(), touched.end());
+    for (size_t i = 0; i < touched.size(); i++) {
+        int idx = touched[i];
+        int arch = idx < NUM_OF_OBSTACLES ? ARCH_OBSTACLE : ARCH_PLAYER;
+        int row = idx < NUM_OF_OBSTACLES ? idx : idx - NUM_OF_OBSTACLES;
+        health_t &hp = world.hp(arch)[row];
+        hp.sethp(hp.gethp() - damage[idx]);
+        if (arch == ARCH_PLAYER) wounds.push_back(make_pair(row, damage[idx]));
+        if (hp.gethp() < 0) {
+            if (arch == ARCH_PLAYER) deaths.push_back(make_pair(row, damage[idx] >= LONG_RANGE_DMG));
+            world.alive(arch)[row] = DEAD;          // for players this is playerStatus
+            const coord_t &at = world.pos(arch)[row];
+            map.setCell(at.x, at.y, leftBehind(map, at.x, at.y));
+        }
+        damage[idx] = 0;
+    }
+    touched.clear();
+}
+
+// ends curses lib and interface
+void endCurses() {
+#ifdef curses
+    refresh();
+    getch();    // asks for one final character
+    endwin();   // closes ncurses lib
+#endif
+}
+
+// initializes curses lib and prints out initial statements/instructions
+void initCurses() {
+#ifdef curses
+    initscr();
+    keypad(stdscr, TRUE); // accepts arrow keys
+    noecho();
+    raw(); //prevents exiting with commands
+#endif
+}
+
+/*
+ * function_identifier: checks when player steps on trigger
+ * parameters: player obj, trigger obj
+ * return value: true if player is on object, false otherwise
+ */
+
+bool winRnd(player_t p, trigger_t t) {
+    // looking to see if player steps on trigger
+    if ((p.pos().x == t.pos().x) && (p.pos().y == t.pos().y)) return true;
+    else return false;
+}
+
+/*
+ * function_identifier: counts and returns number of players alive
+ * parameters: player_t *p
+ * return value: number alive
+ */
+
+int numAlive(player_t *p) {
+    int alive = 0;
+    for (int i = 0; i < PLAYERCNT; i++) {
+        if (p[0].playerStatus[i] == ALIVE)
+            alive++;
+    }
+    return alive;
+}
+
+/*
+ * function_identifier: searches and returns the id of last player alive
+ * parameters: player_t *p
+ * return value: player id
+ */
+
+int whoAlive(player_t *p) {
+    int pid;
+    for (int i = 0; i < PLAYERCNT; i++) {
+    if (p[0].playerStatus[i] == ALIVE)
+        pid = i;
+    }
+    return pid;
+}
+
+/*
+ * function_identifier: checks if winner exists, and decides who it is
+ * parameters: player_t *p, map_t &m, int lastAlive, message the announcement is appended to
+ * return value: true if there is a winner, false if no winner yet
+ */
+
+bool checkVictor(player_t *p, map_t &m, int lastAlive, string &message) {
+    if (numAlive(p)==1) {
+        message += "Victory Royale!\n";
+        message += string("Player '") + (char)(whoAlive(p)+INT_TO_UPPER_ALPH) + "' wins!\n";
+        message += "Game Over!\n";
+        return true;
+    } else if (numAlive(p) == 0) {
+        message += "Victory Royale!\n";
+        message += string("player '") + (char)(lastAlive+INT_TO_UPPER_ALPH) + "' nearly took the L, but won!\n";
+        message += "Game Over!\n";
+        return true;
+    }
+    return false;
+}
+
+// returns whether or not the current cell contains a player
+// used for determining what the storm destroys
+bool isPlayer(ent_t*** egrid, player_t*p, int x, int y){
+    for (int i = 0; i < PLAYERCNT; i++){
+        if (egrid[y][x] == (p+i)) return true;
+    }
+    return false;
+}
+
+const int WHEEL_BITS = 6;
+const int WHEEL_SIZE = 1 << WHEEL_BITS;    // slots per level
+const int WHEEL_LEVELS = 4;                // 64^4 ticks is the longest delay
+
+// what a timer does when it fires, the match dispatches on these
+const int TIMER_RELOAD = 1;         // a: pid whose weapon finishes reloading, b: its inventory slot
+const int TIMER_STORM_GRACE = 2;    // a, b: cell the storm skipped because a player stood there
+const int TIMER_RESPAWN = 3;        // a: pickup row (short ones first, then long ones)
+const int TIMER_COOLDOWN = 4;       // a: pid who may fire the long range weapon again
+
+/*
+ * class_identifier: hierarchical timer wheel, advanced once per tick by the match
+ *                   level 0 has one slot per tick for the next 64 ticks, every level above covers
+ *                   64 times more; timers drop down a level when their slot comes around, so a tick
+ *                   only touches the timers that are due (plus an occasional cascade)
+ *                   timers live in one pool with a free list, nothing is allocated once it's warm
+ * constructors: timerwheel_t()
+ * public functions:    int schedule(unsigned int delay, int kind, int a, int b)
+ *                      void cancel(int id)
+ *                      void advance(vector<event_t>& fired)
+ *                      unsigned int now() const
+ *                      int pending() const
+ * static members: none
+ */
+
+class timerwheel_t {
+public:
+    struct event_t {
+        int kind;
+        int a;
+        int b;
+    };
+    timerwheel_t();
+    int schedule(unsigned int delay, int kind, int a, int b = 0);  // returns an id for cancel()
+    void cancel(int id);
+    void advance(vector<event_t>& fired);  // moves time forward one tick, appends what came due
+    unsigned int now() const {return current;}
+    int pending() const {return count;}
+private:
+    struct node_t {
+        unsigned int due;
+        event_t ev;
+        int next;                       // doubly linked inside a slot, next doubles as the free list
+        int prev;
+        int slot;                       // level * WHEEL_SIZE + index, -1 when free
+    };
+    void link(int id);
+    void unlink(int id);
+    void cascade(int level);
+    vector<node_t> pool;
+    int freeList;
+    int heads[WHEEL_LEVELS * WHEEL_SIZE];
+    unsigned int current;               // last tick that was processed
+    int count;
+};
+
+timerwheel_t::timerwheel_t() {
+    freeList = -1;
+    current = 0;
+    count = 0;
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SIZE; i++) heads[i] = -1;
+}
+
+int timerwheel_t::schedule(unsigned int delay, int kind, int a, int b) {
+    const unsigned int horizon = (1u << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    if (delay < 1) delay = 1;                           // soonest is the next tick
+    if (delay > horizon) delay = horizon;
+    int id;
+    if (freeList >= 0) {
+        id = freeList;
+        freeList = pool[id].next;
+    } else {
+        id = pool.size();
+        pool.push_back(node_t());
+    }
+    pool[id].due = current + delay;
+    pool[id].ev.kind = kind;
+    pool[id].ev.a = a;
+    pool[id].ev.b = b;
+    link(id);
+    count++;
+    return id;
+}
+
+void timerwheel_t::cancel(int id) {
+    if (id < 0 || id >= (int)pool.size() || pool[id].slot < 0) return;
+    unlink(id);
+    pool[id].next = freeList;
+    freeList = id;
+    count--;
+}
+
+// picks the level from how far away the timer is, and the slot from the matching bits of due
+void timerwheel_t::link(int id) {
+    node_t& t = pool[id];
+    unsigned int delta = t.due - current;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1u << (WHEEL_BITS * (level + 1)))) level++;
+    t.slot = level * WHEEL_SIZE + ((t.due >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1));
+    t.prev = -1;
+    t.next = heads[t.slot];
+    if (t.next >= 0) pool[t.next].prev = id;
+    heads[t.slot] = id;
+}
+
+void timerwheel_t::unlink(int id) {
+    node_t& t = pool[id];
+    if (t.prev >= 0) pool[t.prev].next = t.next;
+    else heads[t.slot] = t.next;
+    if (t.next >= 0) pool[t.next].prev = t.prev;
+    t.slot = -1;
+}
+
+// re-files every timer in this level's current slot, they're all closer now
+void timerwheel_t::cascade(int level) {
+    int slot = level * WHEEL_SIZE + ((current >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1));
+    int id = heads[slot];
+    heads[slot] = -1;
+    while (id >= 0) {
+        int next = pool[id].next;
+        link(id);
+        id = next;
+    }
+}
+
+void timerwheel_t::advance(vector<event_t>& fired) {
+    current++;
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if ((current >> (WHEEL_BITS * (level - 1))) & (WHEEL_SIZE - 1)) break;  // lower level didn't wrap
+        cascade(level);
+    }
+    int id = heads[current & (WHEEL_SIZE - 1)];
+    heads[current & (WHEEL_SIZE - 1)] = -1;
+    while (id >= 0) {                                   // everything on level 0 here is due now
+        int next = pool[id].next;
+        fired.push_back(pool[id].ev);
+        pool[id].slot = -1;
+        pool[id].next = freeList;
+        freeList = id;
+        count--;
+        id = next;
+    }
+}
+
+/*
+ * function_identifier: storms one cell. a cell with a player on it is left alone (the player takes
+ *                      storm damage instead) and a timer brings the storm back every STORM_GRACE_TICKS
+ * parameters: map_t &m, ent_t*e, player_t*p, timerwheel_t& timers, x, y
+ * return value: none
+ */
+void stormCell(map_t &m, ent_t*e, player_t*p, timerwheel_t& timers, int x, int y) {
+    if (x < 0 || y < 0 || x >= m.cols || y >= m.rows) return;
+    if (isPlayer(m.egrid, p, x, y))                             // if there is a player
+        timers.schedule(STORM_GRACE_TICKS, TIMER_STORM_GRACE, x, y);
+    else
+        m.setCell(x, y, e);                                     // destroy it
+}
+
+/*
+ * class_identifier: threads a match keeps for its banded storm rounds and status sweeps, started the
+ *                   first time a round needs them and parked between rounds, so a round only pays for
+ *                   a wake up instead of a thread start
+ * constructors: bandpool_t()
+ * public functions:    void run(int bands, const function<void(int)>& fn)
+ * static members: none
+ */
+
+class bandpool_t {
+public:
+    bandpool_t();
+    ~bandpool_t();
+    bandpool_t(const bandpool_t&) = delete;
+    bandpool_t& operator=(const bandpool_t&) = delete;
+    void run(int bands, const function<void(int)>& fn);    // fn(band) for band = 0..bands-1, band 0 here
+private:
+    void worker(int w, unsigned long seen);
+    vector<thread> pool;                // pool[i] runs band i + 1
+    mutex lock;
+    condition_variable wake;            // a new round for the pool
+    condition_variable finished;        // every pool thread is done with it
+    unsigned long generation;
+    int busy;                           // pool threads still on this round
+    bool quitting;
+    int bands;                          // this round's, bands past it leave their thread idle
+    const function<void(int)>* job;
+};
+
+bandpool_t::bandpool_t() {
+    generation = 0;
+    busy = 0;
+    quitting = false;
+    bands = 0;
+    job = nullptr;
+}
+
+bandpool_t::~bandpool_t() {
+    {
+        lock_guard<mutex> hold(lock);
+        quitting = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < pool.size(); i++) pool[i].join();
+}
+
+void bandpool_t::run(int n, const function<void(int)>& fn) {
+    if (n <= 1) {
+        if (n == 1) fn(0);
+        return;
+    }
+    while ((int)pool.size() < n - 1)    // started before generation moves, so they wait for this round
+        pool.push_back(thread(&bandpool_t::worker, this, (int)pool.size() + 1, generation));
+    {
+        lock_guard<mutex> hold(lock);
+        bands = n;
+        job = &fn;
+        busy = pool.size();
+        generation++;
+    }
+    wake.notify_all();
+    fn(0);
+    unique_lock<mutex> hold(lock);
+    finished.wait(hold, [this] {return busy == 0;});
+}
+
+void bandpool_t::worker(int w, unsigned long seen) {
+    while (true) {
+        {
+            unique_lock<mutex> hold(lock);
+            wake.wait(hold, [&] {return quitting || generation != seen;});
+            if (quitting) return;
+            seen = generation;
+        }
+        if (w < bands) (*job)(w);
+        lock_guard<mutex> hold(lock);
+        if (--busy == 0) finished.notify_one();
+    }
+}
+
+const int STORM_BAND_CELLS = 4096;      // below this many storm cells per thread a round stays serial
+const int STATUS_BAND_PLAYERS = 4096;   // same for the player status sweep
+
+/*
+ * function_identifier: advances the storm posiiton on the map
+ *                      with threads > 1 the edges are split into bands - the columns by rows, the
+ *                      rows by columns - and each band writes its own cells and lists what it skipped
+ *                      for players and what it flipped. the lists are then replayed in the serial
+ *                      order, so timers and observers see exactly what the serial loops would produce
+ * parameters: map_t &m, ent_t*e, player_t*p, timerwheel_t& timers, threads the round may use
+ * return value: none
+ */
+void update(map_t &m, ent_t*e, player_t*p, timerwheel_t& timers, bandpool_t& pool, int threads) {
+    bool side[4] = {m.dXR == m.radius, m.dXL == m.radius, m.dYU == m.radius, m.dYB == m.radius};
+    int line[4] = {m.centerCoord.x + m.dXR, m.centerCoord.x - m.dXL, m.centerCoord.y - m.dYU, m.centerCoord.y + m.dYB};
+    int bands = std::min(threads, (2 * m.rows + 2 * m.cols) / STORM_BAND_CELLS);
+
+    if (bands <= 1) {
+        if (side[0]) {                                              // remove right
+            for (int i = 0; i < m.rows; i++)
+                stormCell(m, e, p, timers, line[0], i);
+        }
+        if (side[1]) {                                              // remove left
+            for (int i = 0; i < m.rows; i++)
+                stormCell(m, e, p, timers, line[1], i);
+        }
+        if (side[2]) {                                              // remove up
+            for (int i = 0; i < m.cols; i++)
+                stormCell(m, e, p, timers, i, line[2]);
+        }
+        if (side[3]) {                                              // remove down
+            for (int i = 0; i < m.cols; i++)
+                stormCell(m, e, p, timers, i, line[3]);
+        }
+    } else {
+        // band b owns rows [b*rows/bands, ...) of the columns and columns [b*cols/bands, ...) of the rows
+        // a cell where a column crosses a row is left to the column, the row only repeats its grace timer
+        struct written_t {
+            int cell;
+            int flips;                              // CELL_FLIP_* bits
+            ent_t* was;
+        };
+        struct band_t {
+            vector<int> grace[4];                   // cells the storm skipped, per side
+            vector<written_t> written[4];
+        };
+        vector<band_t> out(bands);
+        bool tracking = !m.changedFlag.empty() || m.journal != nullptr;
+        pool.run(bands, [&](int b) {
+            for (int s = 0; s < 4; s++) {
+                if (!side[s]) continue;
+                int len = s < 2 ? m.rows : m.cols;
+                for (int i = (long)len * b / bands; i < (long)len * (b + 1) / bands; i++) {
+                    int x = s < 2 ? line[s] : i;
+                    int y = s < 2 ? i : line[s];
+                    if (x < 0 || y < 0 || x >= m.cols || y >= m.rows) continue;
+                    if (s >= 2 && ((side[0] && x == line[0]) || (side[1] && x == line[1]))) continue;
+                    int cell = y * m.cols + x;
+                    if (isPlayer(m.egrid, p, x, y)) {
+                        out[b].grace[s].push_back(cell);
+                    } else {
+                        written_t w = {cell, 0, m.egrid[y][x]};
+                        w.flips = m.writeCell(x, y, e);
+                        if (w.flips != 0 || tracking) out[b].written[s].push_back(w);
+                    }
+                }
+            }
+        });
+
+        for (int s = 0; s < 4; s++) {
+            if (!side[s]) continue;
+            vector<int> grace;
+            for (int b = 0; b < bands; b++)
+                grace.insert(grace.end(), out[b].grace[s].begin(), out[b].grace[s].end());
+            for (int c = 0; c < 2 && s >= 2; c++) {         // crossings: a player there gets a second timer
+                int x = line[c], y = line[s];
+                if (side[c] && x >= 0 && y >= 0 && x < m.cols && y < m.rows && isPlayer(m.egrid, p, x, y)
+                    && (c == 0 || !side[0] || line[0] != x))
+                    grace.insert(lower_bound(grace.begin(), grace.end(), y * m.cols + x), y * m.cols + x);
+            }
+            for (size_t i = 0; i < grace.size(); i++)
+                timers.schedule(STORM_GRACE_TICKS, TIMER_STORM_GRACE, grace[i] % m.cols, grace[i] / m.cols);
+            for (int b = 0; b < bands; b++) {
+                for (size_t i = 0; i < out[b].written[s].size(); i++) {
+                    const written_t& w = out[b].written[s][i];
+                    m.cellWritten(w.cell % m.cols, w.cell / m.cols, w.flips, w.was);
+                }
+            }
+        }
+    }
+    if (side[0]) m.dXR -= 1;
+    if (side[1]) m.dXL -= 1;
+    if (side[2]) m.dYU -= 1;
+    if (side[3]) m.dYB -= 1;
+    m.radius -= 1;
+}
+
+/*
+ * class_identifier: hands out distinct cells of the map in random order without building a list of
+ *                   all of them - a Fisher-Yates shuffle where only the swapped slots are stored,
+ *                   so drawing k cells costs O(k) no matter how big the map is
+ * constructors: cellsampler_t(int cells, unsigned int& seed)
+ * public functions:    bool next(int& cell)
+ *                      void putBack(int cell)
+ * static members: none
+ */
+
+class cellsampler_t {
+public:
+    cellsampler_t(int cells, unsigned int& rng) : left(cells), seed(rng) {}
+    bool next(int& cell);               // false once every cell has been handed out
+    void putBack(int cell);             // a drawn cell goes back into the pool
+private:
+    int valueAt(int i) const;
+    unordered_map<int, int> moved;      // slot -> cell, for slots that aren't holding themselves
+    int left;
+    unsigned int& seed;
+};
+
+int cellsampler_t::valueAt(int i) const {
+    unordered_map<int, int>::const_iterator it = moved.find(i);
+    return it == moved.end() ? i : it->second;
+}
+
+bool cellsampler_t::next(int& cell) {
+    if (left == 0) return false;
+    int j = rand_r(&seed) % left;
+    cell = valueAt(j);
+    int last = valueAt(left - 1);
+    if (j != left - 1) moved[j] = last;                 // the last slot fills the hole
+    moved.erase(left - 1);
+    left--;
+    return true;
+}
+
+void cellsampler_t::putBack(int cell) {
+    if (cell != left) moved[left] = cell;
+    left++;
+}
+
+/*
+ * function_identifier: places players spread out (dart throwing with a minimum spacing, giving up on
+ *                      the spacing after a few misses), then obstacles and weapons, all on distinct
+ *                      free cells. if the map runs out of cells the players that didn't fit are dead
+ *                      and the obstacles/weapons that didn't fit stay off the map
+ * parameters: map_t &map, player_t *p, obstacle_t *o, trigger_t *shortWep, trigger_t *longWep, unsigned int &seed
+ * return value: none
+ */
+void spawnEntities(map_t &map, player_t *p, obstacle_t *o, trigger_t *shortWep, trigger_t *longWep, unsigned int &seed) {
+    for (int i = 0; i < NUM_LONG_WEPS; i++)
+        longWep[i].setSymbol('!');          // setting the long rage weapon symbol
+
+    cellsampler_t cells(map.rows * map.cols, seed);
+    int cell;
+
+    // players - a coarse bucket grid of already placed players answers "anyone too close?"
+    int spacing = (int)sqrt(map.rows * map.cols / (2.0 * PLAYERCNT));
+    if (spacing < 1) spacing = 1;
+    int bucketCols = map.cols / spacing + 1;
+    vector<vector<int> > buckets(bucketCols * (map.rows / spacing + 1));
+    vector<int> rejected;
+    for (int i = 0; i < PLAYERCNT; i++) {
+        bool placed = false;
+        for (int attempt = 0; !placed && cells.next(cell); attempt++) {
+            int x = cell % map.cols, y = cell / map.cols;
+            if (map.at(x, y) != nullptr) continue;      // already taken (e.g. an authored map)
+            bool crowded = false;
+            int bx = x / spacing, by = y / spacing;
+            for (int ny = by - 1; ny <= by + 1 && !crowded && attempt < 30; ny++) {
+                for (int nx = bx - 1; nx <= bx + 1 && !crowded; nx++) {
+                    if (nx < 0 || ny < 0 || nx >= bucketCols || ny * bucketCols + nx >= (int)buckets.size()) continue;
+                    vector<int>& b = buckets[ny * bucketCols + nx];
+                    for (size_t k = 0; k < b.size(); k++) {
+                        int dx = p[b[k]].pos().x - x, dy = p[b[k]].pos().y - y;
+                        if (dx * dx + dy * dy < spacing * spacing) crowded = true;
+                    }
+                }
+            }
+            if (crowded) {
+                rejected.push_back(cell);
+                continue;
+            }
+            p[i].pos() = coord_t(x, y);
+            map.dynAddEnt(&(p[i]), p[i].pos());
+            buckets[by * bucketCols + bx].push_back(i);
+            placed = true;
+        }
+        for (size_t k = 0; k < rejected.size(); k++) cells.putBack(rejected[k]);  // still free for the next one
+        rejected.clear();
+        if (!placed) p[i].removePlayer();               // no room left on this map
+    }
+
+    // obstacles and weapons just need a free cell each
+    for (int i = 0; i < NUM_OF_OBSTACLES + NUM_SHORT_WEPS + NUM_LONG_WEPS; i++) {
+        ent_t* ent;
+        if (i < NUM_OF_OBSTACLES) ent = &o[i];
+        else if (i < NUM_OF_OBSTACLES + NUM_SHORT_WEPS) ent = &shortWep[i - NUM_OF_OBSTACLES];
+        else ent = &longWep[i - NUM_OF_OBSTACLES - NUM_SHORT_WEPS];
+        bool placed = false;
+        while (!placed && cells.next(cell)) {
+            int x = cell % map.cols, y = cell / map.cols;
+            if (map.at(x, y) != nullptr) continue;
+            ent->pos() = coord_t(x, y);
+            map.dynAddEnt(ent, ent->pos());
+            placed = true;
+        }
+    }
+}
+
+/*
+ * class_identifier: an authored arena on disk, mapped read only and used in place - nothing is parsed
+ *                   layout: mapheader_t, then uint32 cell indices (y*cols+x) for the walls, the 25
+ *                   player spawns (NO_CELL if that player spawns anywhere), the '#' and the '!' spawns
+ *                   written in the machine's own byte order, like the rest of the game's data
+ * constructors: mapfile_t()
+ * public functions:    bool open(const char* path)
+ *                      void close()
+ * static members: none
+ */
+
+const uint32_t NO_CELL = 0xffffffff;
+const char MAPFILE_MAGIC[8] = "VBRMAP1";
+const uint64_t MAPFILE_MAX_CELLS = 0x7fffffff;  // cell indices are ints everywhere past the file
+
+struct mapheader_t {
+    char magic[8];
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t center;        // storm center cell, NO_CELL for a random one
+    uint32_t walls;         // how many of each list follow the header
+    uint32_t spawns;
+    uint32_t shortWeps;
+    uint32_t longWeps;
+    uint32_t reserved;      // keeps the lists 8 byte aligned
+};
+
+class mapfile_t {
+public:
+    mapfile_t() {base = nullptr; size = 0; header = nullptr; walls = spawns = shortWeps = longWeps = nullptr;}
+    ~mapfile_t() {close();}
+    bool open(const char* path);        // false if the file is missing, truncated, too big to play or not a map
+    void close();
+    const mapheader_t* header;
+    const uint32_t* walls;              // all of these point straight into the mapping
+    const uint32_t* spawns;
+    const uint32_t* shortWeps;
+    const uint32_t* longWeps;
+private:
+    void* base;
+    size_t size;
+};
+
+bool mapfile_t::open(const char* path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(mapheader_t)) {::close(fd); return false;}
+    size = st.st_size;
+    base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);                        // the mapping keeps the file alive
+    if (base == MAP_FAILED) {base = nullptr; return false;}
+
+    const mapheader_t* h = (const mapheader_t*)base;
+    uint64_t lists = (uint64_t)h->walls + h->spawns + h->shortWeps + h->longWeps;
+    if (memcmp(h->magic, MAPFILE_MAGIC, sizeof(h->magic)) != 0 || h->cols == 0 || h->rows == 0 ||
+        (uint64_t)h->cols * h->rows > MAPFILE_MAX_CELLS || sizeof(mapheader_t) + lists * sizeof(uint32_t) > size) {
+        close();
+        return false;
+    }
+    header = h;
+    walls = (const uint32_t*)(h + 1);
+    spawns = walls + h->walls;
+    shortWeps = spawns + h->spawns;
+    longWeps = shortWeps + h->shortWeps;
+    return true;
+}
+
+void mapfile_t::close() {
+    if (base != nullptr) munmap(base, size);
+    base = nullptr;
+    header = nullptr;
+    walls = spawns = shortWeps = longWeps = nullptr;
+}
+
+/*
+ * function_identifier: turns a plain text arena into a map file
+ *                      '@' wall, '#' short range weapon, '!' long range weapon, 'A'-'Y' where that
+ *                      player spawns, '*' storm center, space is open ground
+ * parameters: text file to read, map file to write
+ * return value: exit code
+ */
+int convertMap(const char* in, const char* out) {
+    ifstream text(in);
+    if (!text) {
+        cerr << "could not read " << in << endl;
+        return 1;
+    }
+    vector<string> lines;
+    string line;
+    size_t cols = 0;
+    while (getline(text, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        cols = std::max(cols, line.size());
+        lines.push_back(line);
+    }
+    while (!lines.empty() && lines.back().empty()) lines.pop_back();    // trailing blank lines
+    if (lines.empty() || cols == 0) {
+        cerr << in << " is empty" << endl;
+        return 1;
+    }
+
+    mapheader_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAPFILE_MAGIC, sizeof(h.magic));
+    h.cols = cols;
+    h.rows = lines.size();
+    h.center = NO_CELL;
+    vector<uint32_t> walls, spawns(PLAYERCNT, NO_CELL), shortWeps, longWeps;
+    for (size_t y = 0; y < lines.size(); y++) {
+        for (size_t x = 0; x < lines[y].size(); x++) {
+            char c = lines[y][x];
+            uint32_t cell = y * cols + x;
+            if (c == ' ') continue;
+            else if (c == '@') walls.push_back(cell);
+            else if (c == '#') shortWeps.push_back(cell);
+            else if (c == '!') longWeps.push_back(cell);
+            else if (c == '*' && h.center == NO_CELL) h.center = cell;
+            else if (c >= 'A' && c < 'A' + PLAYERCNT && spawns[c - 'A'] == NO_CELL) spawns[c - 'A'] = cell;
+            else {
+                cerr << in << ":" << y + 1 << ":" << x + 1 << ": unexpected or repeated '" << c << "'" << endl;
+                return 1;
+            }
+        }
+    }
+    if (shortWeps.size() > NUM_SHORT_WEPS || longWeps.size() > NUM_LONG_WEPS) {
+        cerr << in << ": at most " << NUM_SHORT_WEPS << " '#' and " << NUM_LONG_WEPS << " '!'" << endl;
+        return 1;
+    }
+    h.walls = walls.size();
+    h.spawns = spawns.size();
+    h.shortWeps = shortWeps.size();
+    h.longWeps = longWeps.size();
+
+    ofstream file(out, ios::binary | ios::trunc);
+    file.write((const char*)&h, sizeof(h));
+    file.write((const char*)walls.data(), walls.size() * sizeof(uint32_t));
+    file.write((const char*)spawns.data(), spawns.size() * sizeof(uint32_t));
+    file.write((const char*)shortWeps.data(), shortWeps.size() * sizeof(uint32_t));
+    file.write((const char*)longWeps.data(), longWeps.size() * sizeof(uint32_t));
+    if (!file.flush()) {
+        cerr << "could not write " << out << endl;
+        return 1;
+    }
+    cout << in << ": " << h.cols << "x" << h.rows << ", " << walls.size() << " walls, "
+         << shortWeps.size() << " '#', " << longWeps.size() << " '!'" << endl;
+    return 0;
+}
+
+// --------------------------------- ANALYTICS ---------------------------------
+// hosted matches can log what happens in them: where every player stands each tick, who died where and
+// how, weapon pickups and the storm radius. rows are collected per match in blocks of STAT_BLOCK_ROWS and
+// written column by column, each column with its own encoding. each match also counts its rows into one
+// heatmap the size of its arena and hands it to the sink when it ends, readStats() rebuilds the same
+// heatmaps from a file block by block
+
+const int STAT_POS = 0;             // kinds of rows: a player's position at the end of a tick
+const int STAT_STORM_DEATH = 1;     // deaths, at the cell the player died on
+const int STAT_SHORT_DEATH = 2;
+const int STAT_LONG_DEATH = 3;
+const int STAT_SHORT_PICKUP = 4;    // a '#' picked up at x, y
+const int STAT_LONG_PICKUP = 5;
+const int STAT_STORM = 6;           // storm round advanced, x = radius, y = round
+const int STAT_KINDS = 7;
+const int STAT_COLUMNS = 5;         // tick, kind, pid, x, y
+const int STAT_BLOCK_ROWS = 2048;
+const uint64_t STAT_MAX_CELLS = 1 << 24;    // largest arena a heatmap is kept for, 6 grids of 8 byte counts each
+const char STATFILE_MAGIC[8] = "VBRSTA2";   // 2: 32 bit arena sizes in the block headers
+
+/*
+ * function_identifier: varint helpers for the stat columns, 7 bits per byte, high bit means more follows.
+ *                      signed values are zigzagged first so small negative deltas stay one byte
+ * parameters: output buffer and value / read cursor, end of the buffer and value
+ * return value: getVarint: false if the buffer ends mid number
+ */
+void putVarint(vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(v);
+}
+
+bool getVarint(const uint8_t*& at, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; at < end && shift < 35; shift += 7) {
+        uint8_t b = *at++;
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+uint32_t zigzag(int32_t v) {return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);}
+int32_t unzigzag(uint32_t v) {return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);}
+
+/*
+ * class_identifier: per cell counts for every kind of row, plus the storm radius per round. fit() sizes it
+ *                   for an arena up front, it grows to the largest one it has seen and smaller arenas land
+ *                   in its top left corner. rows off the fitted grid are refused rather than grown into
+ * constructors: heatmap_t()
+ * public functions:    bool fit(int cols, int rows)
+ *                      bool add(int kind, int x, int y)
+ *                      bool merge(const heatmap_t& other)
+ *                      void print(ostream& out) const
+ *                      unsigned long long total(int kind) const
+ * static members: none
+ */
+
+class heatmap_t {
+public:
+    heatmap_t() {cols = rows = 0;}
+    bool fit(int c, int r);         // false, and no change, past STAT_MAX_CELLS
+    bool add(int kind, int x, int y);   // false if the row doesn't land on the fitted grid
+    bool merge(const heatmap_t& other);    // false, and no change, if the two don't fit in one
+    void print(ostream& out) const;
+    unsigned long long total(int kind) const {return totals[kind];}
+    unsigned long long games = 0;                   // matches that finished while being logged
+private:
+    int cols;
+    int rows;
+    vector<unsigned long long> counts[STAT_STORM];  // one grid per cell kind
+    vector<unsigned long long> radiusSum;           // per round
+    vector<unsigned long long> radiusSeen;
+    unsigned long long totals[STAT_KINDS] = {0};
+};
+
+bool heatmap_t::fit(int c, int r) {
+    if (c <= cols && r <= rows) return true;
+    int nc = std::max(c, cols), nr = std::max(r, rows);
+    if ((uint64_t)nc * nr > STAT_MAX_CELLS) return false;
+    for (int k = 0; k < STAT_STORM; k++) {
+        vector<unsigned long long> grown((size_t)nc * nr, 0);
+        for (int y = 0; y < rows; y++)
+            for (int x = 0; x < cols; x++) grown[(size_t)y * nc + x] = counts[k][(size_t)y * cols + x];
+        counts[k].swap(grown);
+    }
+    cols = nc;
+    rows = nr;
+    return true;
+}
+
+// a storm row is (radius, round), and a storm can't shrink for more rounds than the arena is wide and tall
+bool heatmap_t::add(int kind, int x, int y) {
+    if (kind < 0 || kind >= STAT_KINDS || x < 0 || y < 0) return false;
+    if (kind == STAT_STORM) {
+        if (x > cols + rows || y > cols + rows) return false;
+        if ((int)radiusSum.size() <= y) {radiusSum.resize(y + 1, 0); radiusSeen.resize(y + 1, 0);}
+        radiusSum[y] += x;
+        radiusSeen[y]++;
+    } else {
+        if (x >= cols || y >= rows) return false;
+        counts[kind][(size_t)y * cols + x]++;
+    }
+    totals[kind]++;
+    return true;
+}
+
+bool heatmap_t::merge(const heatmap_t& other) {
+    if (!fit(other.cols, other.rows)) return false;
+    for (int k = 0; k < STAT_STORM; k++)
+        for (int y = 0; y < other.rows; y++)
+            for (int x = 0; x < other.cols; x++) counts[k][y * cols + x] += other.counts[k][y * other.cols + x];
+    if (radiusSum.size() < other.radiusSum.size()) {
+        radiusSum.resize(other.radiusSum.size(), 0);
+        radiusSeen.resize(other.radiusSum.size(), 0);
+    }
+    for (size_t i = 0; i < other.radiusSum.size(); i++) {
+        radiusSum[i] += other.radiusSum[i];
+        radiusSeen[i] += other.radiusSeen[i];
+    }
+    for (int k = 0; k < STAT_KINDS; k++) totals[k] += other.totals[k];
+    games += other.games;
+    return true;
+}
+
+// one shaded grid per kind, darker is more, scaled to that grid's busiest cell
+void heatmap_t::print(ostream& out) const {
+    static const char* NAMES[STAT_STORM] = {"positions", "storm deaths", "short range deaths",
+                                            "long range deaths", "'#' pickups", "'!' pickups"};
+    static const char SHADES[] = " .:-=+*#%@";
+    out << games << " games" << endl;
+    for (int k = 0; k < STAT_STORM; k++) {
+        unsigned long long most = 0;
+        for (size_t i = 0; i < counts[k].size(); i++) most = std::max(most, counts[k][i]);
+        out << NAMES[k] << ": " << totals[k] << endl;
+        if (most == 0) continue;
+        for (int y = 0; y < rows; y++) {
+            string line(cols, ' ');
+            for (int x = 0; x < cols; x++) {
+                unsigned long long n = counts[k][y * cols + x];
+                if (n > 0) line[x] = SHADES[1 + (n - 1) * (sizeof(SHADES) - 3) / most];
+            }
+            out << '|' << line << '|' << endl;
+        }
+    }
+    out << "storm radius by round:";
+    for (size_t i = 0; i < radiusSum.size(); i++)
+        if (radiusSeen[i] > 0) out << " " << i << ":" << radiusSum[i] / (double)radiusSeen[i];
+    out << endl;
+}
+
+/*
+ * class_identifier: one encoded block in a stat file, right after the file's magic or the previous block
+ *                   the columns follow in order tick, kind, pid, x, y. tick is a varint delta from the row
+ *                   before (ticks never go back inside a block), kind is (value, run length) pairs and
+ *                   pid, x and y are zigzagged varint deltas
+ */
+
+struct statblock_t {
+    uint32_t match;                 // which match the rows belong to, unique within a file
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t count;                 // rows in the block
+    uint32_t bytes[STAT_COLUMNS];   // encoded size of each column
+    uint32_t finished;              // 1 if the match ended with this block
+};
+
+/*
+ * class_identifier: the file every logged match appends its blocks to. many matches write at once, a
+ *                   block goes out whole under the lock, and a match's heatmap is folded in once at its end
+ * constructors: statsink_t()
+ * public functions:    bool open(const char* path)
+ *                      int newMatch()
+ *                      void write(const statblock_t& b, const vector<uint8_t>* columns)
+ *                      void fold(const heatmap_t& matchHeat)
+ *                      heatmap_t totals()
+ *                      unsigned long long bytes()
+ * static members: none
+ */
+
+class statsink_t {
+public:
+    statsink_t() : matches(0) {written = 0;}
+    bool open(const char* path);
+    int newMatch() {return matches++;}
+    void write(const statblock_t& b, const vector<uint8_t>* columns);
+    void fold(const heatmap_t& matchHeat);
+    heatmap_t totals();
+    unsigned long long bytes();
+private:
+    mutex lock;
+    ofstream file;
+    heatmap_t heat;
+    atomic<int> matches;
+    unsigned long long written;
+};
+
+bool statsink_t::open(const char* path) {
+    file.open(path, ios::binary | ios::trunc);
+    file.write(STATFILE_MAGIC, sizeof(STATFILE_MAGIC));
+    written = sizeof(STATFILE_MAGIC);
+    return (bool)file;
+}
+
+void statsink_t::write(const statblock_t& b, const vector<uint8_t>* columns) {
+    lock_guard<mutex> hold(lock);
+    file.write((const char*)&b, sizeof(b));
+    written += sizeof(b);
+    for (int c = 0; c < STAT_COLUMNS; c++) {
+        file.write((const char*)columns[c].data(), columns[c].size());
+        written += columns[c].size();
+    }
+}
+
+void statsink_t::fold(const heatmap_t& matchHeat) {
+    lock_guard<mutex> hold(lock);
+    heat.merge(matchHeat);
+}
+
+heatmap_t statsink_t::totals() {
+    lock_guard<mutex> hold(lock);
+    file.flush();
+    return heat;
+}
+
+unsigned long long statsink_t::bytes() {
+    lock_guard<mutex> hold(lock);
+    return written;
+}
+
+/*
+ * class_identifier: one match's rows until they fill a block, and its heatmap until the match is over.
+ *                   only the thread stepping the match records into it
+ * constructors: statlog_t(statsink_t& sink, int cols, int rows)
+ * public functions:    void record(uint32_t tick, int kind, int pid, int x, int y)
+ *                      void flush(bool finished)
+ * static members: none
+ */
+
+class statlog_t {
+public:
+    statlog_t(statsink_t& sink, int cols, int rows);   // cols * rows at most STAT_MAX_CELLS
+    ~statlog_t() {flush(false);}
+    void record(uint32_t tick, int kind, int pid, int x, int y);
+    void flush(bool finished);      // the last rows and the heatmap go to the sink, later calls do nothing
+private:
+    void writeBlock(bool finished);
+    statsink_t& sink;
+    int match;
+    int cols;
+    int rows;
+    bool flushed;
+    vector<uint32_t> tick;          // the block being filled, one vector per column
+    vector<uint8_t> kind;
+    vector<uint8_t> pid;
+    vector<int32_t> x;              // any arena size a match can have
+    vector<int32_t> y;
+    heatmap_t heat;                 // the whole match's rows, sized for its arena once
+    vector<uint8_t> encoded[STAT_COLUMNS];
+};
+
+statlog_t::statlog_t(statsink_t& s, int c, int r) : sink(s) {
+    match = sink.newMatch();
+    cols = c;
+    rows = r;
+    flushed = false;
+    heat.fit(c, r);
+}
+
+void statlog_t::record(uint32_t t, int k, int p, int cx, int cy) {
+    tick.push_back(t);
+    kind.push_back(k);
+    pid.push_back(p);
+    x.push_back(cx);
+    y.push_back(cy);
+    heat.add(k, cx, cy);
+    if ((int)tick.size() == STAT_BLOCK_ROWS) writeBlock(false);
+}
+
+void statlog_t::flush(bool finished) {
+    if (flushed) return;
+    if (!tick.empty() || finished) writeBlock(finished);
+    if (finished) heat.games++;
+    sink.fold(heat);
+    heat = heatmap_t();
+    flushed = true;
+}
+
+void statlog_t::writeBlock(bool finished) {
+    for (int c = 0; c < STAT_COLUMNS; c++) encoded[c].clear();
+    uint32_t lastTick = tick.empty() ? 0 : tick[0];
+    putVarint(encoded[0], lastTick);
+    for (size_t i = 1; i < tick.size(); i++) {
+        putVarint(encoded[0], tick[i] - lastTick);
+        lastTick = tick[i];
+    }
+    for (size_t i = 0; i < kind.size(); ) {
+        size_t run = 1;
+        while (i + run < kind.size() && kind[i + run] == kind[i]) run++;
+        encoded[1].push_back(kind[i]);
+        putVarint(encoded[1], run);
+        i += run;
+    }
+    int lastPid = 0, lastX = 0, lastY = 0;
+    for (size_t i = 0; i < tick.size(); i++) {
+        putVarint(encoded[2], zigzag(pid[i] - lastPid));
+        putVarint(encoded[3], zigzag(x[i] - lastX));
+        putVarint(encoded[4], zigzag(y[i] - lastY));
+        lastPid = pid[i];
+        lastX = x[i];
+        lastY = y[i];
+    }
+
+    statblock_t b;
+    memset(&b, 0, sizeof(b));
+    b.match = match;
+    b.cols = cols;
+    b.rows = rows;
+    b.count = tick.size();
+    for (int c = 0; c < STAT_COLUMNS; c++) b.bytes[c] = encoded[c].size();
+    b.finished = finished;
+    sink.write(b, encoded);
+
+    tick.clear();
+    kind.clear();
+    pid.clear();
+    x.clear();
+    y.clear();
+}
+
+/*
+ * function_identifier: streams a stat file block by block into heat, prints it if asked. heat is fitted to
+ *                      each block's arena from its header, and a row off that arena makes the block bad
+ * parameters: file, where to add the counts
+ * return value: exit code
+ */
+int readStats(const char* path, heatmap_t& heat) {
+    ifstream file(path, ios::binary);
+    char magic[sizeof(STATFILE_MAGIC)];
+    if (!file.read(magic, sizeof(magic)) || memcmp(magic, STATFILE_MAGIC, sizeof(magic)) != 0) {
+        cerr << path << " is not a stat file" << endl;
+        return 1;
+    }
+    statblock_t b;
+    vector<uint8_t> columns[STAT_COLUMNS];
+    while (file.read((char*)&b, sizeof(b))) {
+        for (int c = 0; c < STAT_COLUMNS; c++) {
+            columns[c].resize(b.bytes[c]);
+            if (!file.read((char*)columns[c].data(), b.bytes[c])) {
+                cerr << path << ": truncated block" << endl;
+                return 1;
+            }
+        }
+        if (b.cols == 0 || b.rows == 0 || (uint64_t)b.cols * b.rows > STAT_MAX_CELLS || !heat.fit(b.cols, b.rows)) {
+            cerr << path << ": match " << b.match << " is on a " << b.cols << "x" << b.rows
+                 << " arena, too big for a heatmap" << endl;
+            return 1;
+        }
+        const uint8_t* at[STAT_COLUMNS];
+        const uint8_t* end[STAT_COLUMNS];
+        for (int c = 0; c < STAT_COLUMNS; c++) {
+            at[c] = columns[c].data();
+            end[c] = at[c] + columns[c].size();
+        }
+        uint32_t t = 0, run = 0, v;
+        int kind = 0;
+        int64_t pid = 0, x = 0, y = 0;              // wide enough that no run of deltas can overflow them
+        int64_t roundMax = (int64_t)b.cols + b.rows;
+        for (uint32_t i = 0; i < b.count; i++) {
+            bool ok = getVarint(at[0], end[0], v);
+            t = i == 0 ? v : t + v;                     // ticks aren't needed for the maps, but keep the cursor right
+            if (ok && run == 0) {
+                ok = at[1] < end[1];
+                if (ok) kind = *at[1]++;
+                ok = ok && getVarint(at[1], end[1], run);
+            }
+            run--;
+            ok = ok && getVarint(at[2], end[2], v);
+            pid += unzigzag(v);
+            ok = ok && getVarint(at[3], end[3], v);
+            x += unzigzag(v);
+            ok = ok && getVarint(at[4], end[4], v);
+            y += unzigzag(v);
+            bool inside = x >= 0 && y >= 0 && (kind == STAT_STORM ? x <= roundMax && y <= roundMax : x < b.cols && y < b.rows);
+            if (!ok || !inside || !heat.add(kind, (int)x, (int)y)) {
+                cerr << path << ": bad block in match " << b.match << endl;
+                return 1;
+            }
+        }
+        if (b.finished) heat.games++;
+    }
+    return 0;
+}
+
+// ---------------------------------- EVENTS ----------------------------------
+// what happens in a match (kills, damage, pickups, storm rounds, the win) goes out as small typed
+// events through a bounded lock-free queue. the tick thread only ever claims a slot and copies the
+// event in, it never waits and never allocates; a full queue drops the event and counts it.
+// whoever cares (the host's tallies, the local game's feed) reads them on its own thread
+
+const int EVENT_KILL = 0;           // value: the cause, STAT_STORM_DEATH, STAT_SHORT_DEATH or STAT_LONG_DEATH
+const int EVENT_DAMAGE = 1;         // value: hp lost to an attack
+const int EVENT_PICKUP = 2;         // value: the inventory slot the weapon went into
+const int EVENT_STORM = 3;          // value: storm radius after it advanced
+const int EVENT_ROUND_END = 4;      // value: the round that just ended
+const int EVENT_VICTORY = 5;        // pid: the winner
+const int EVENT_KINDS = 6;
+const unsigned int EVENT_QUEUE = 1 << 16;   // slots in a bus, a power of two
+
+struct gameevent_t {
+    unsigned int tick;
+    int match;                      // the publisher's numbering, the host uses its slot numbers
+    unsigned char kind;
+    unsigned char pid;              // who it happened to
+    short x, y;                     // where, if anywhere
+    int value;
+};
+
+// anything that wants the events, called on the bus's dispatcher thread
+class subscriber_t {
+public:
+    virtual ~subscriber_t() {}
+    virtual void onEvent(const gameevent_t& ev) = 0;
+};
+
+/*
+ * class_identifier: multi producer / multi consumer ring of game events. every slot carries a sequence
+ *                   number that says whether it's free for the lap a producer is on or filled for the lap
+ *                   a consumer is on, so producers and consumers only ever CAS their own cursor. publish()
+ *                   gives up at once on a full ring (and counts it) rather than wait for a reader.
+ *                   events can be taken with poll() from any thread, or start() runs a dispatcher that
+ *                   hands every event to every subscriber
+ * constructors: eventbus_t(unsigned int capacity)
+ * public functions:    bool publish(const gameevent_t& ev)
+ *                      bool poll(gameevent_t& ev)
+ *                      void subscribe(subscriber_t* s)
+ *                      void start()
+ *                      void stop()
+ *                      unsigned long dropped() const
+ * static members: none
+ */
+
+class eventbus_t {
+public:
+    explicit eventbus_t(unsigned int capacity);     // a power of two
+    ~eventbus_t() {stop();}
+    eventbus_t(const eventbus_t&) = delete;
+    eventbus_t& operator=(const eventbus_t&) = delete;
+    bool publish(const gameevent_t& ev);    // any thread, false if the ring was full and the event dropped
+    bool poll(gameevent_t& ev);             // any thread, false if nothing is waiting
+    void subscribe(subscriber_t* s) {subscribers.push_back(s);}    // before start()
+    void start();
+    void stop();                            // delivers whatever is still queued, then joins the dispatcher
+    unsigned long dropped() const {return lost.load(memory_order_relaxed);}
+private:
+    struct cell_t {
+        atomic<unsigned int> seq;   // == cursor: free for that producer, == cursor + 1: filled for that consumer
+        gameevent_t ev;
+    };
+    void dispatch();
+    unique_ptr<cell_t[]> cells;
+    unsigned int mask;
+    alignas(64) atomic<unsigned int> head;      // next slot to take
+    alignas(64) atomic<unsigned int> tail;      // next slot to fill
+    alignas(64) atomic<unsigned long> lost;
+    vector<subscriber_t*> subscribers;
+    thread dispatcher;
+    atomic<bool> stopping;
+};
+
+eventbus_t::eventbus_t(unsigned int capacity) : cells(new cell_t[capacity]), mask(capacity - 1),
+                                                 head(0), tail(0), lost(0), stopping(false) {
+    for (unsigned int i = 0; i < capacity; i++) cells[i].seq.store(i, memory_order_relaxed);
+}
+
+bool eventbus_t::publish(const gameevent_t& ev) {
+    unsigned int t = tail.load(memory_order_relaxed);
+    while (true) {
+        cell_t& c = cells[t & mask];
+        int lap = (int)(c.seq.load(memory_order_acquire) - t);
+        if (lap == 0) {
+            if (tail.compare_exchange_weak(t, t + 1, memory_order_relaxed)) {
+                c.ev = ev;
+                c.seq.store(t + 1, memory_order_release);
+                return true;
+            }
+        } else if (lap < 0) {                           // still holds last lap's event, the ring is full
+            lost.fetch_add(1, memory_order_relaxed);
+            return false;
+        } else {
+            t = tail.load(memory_order_relaxed);        // another producer took it
+        }
+    }
+}
+
+bool eventbus_t::poll(gameevent_t& ev) {
+    unsigned int h = head.load(memory_order_relaxed);
+    while (true) {
+        cell_t& c = cells[h & mask];
+        int lap = (int)(c.seq.load(memory_order_acquire) - (h + 1));
+        if (lap == 0) {
+            if (head.compare_exchange_weak(h, h + 1, memory_order_relaxed)) {
+                ev = c.ev;
+                c.seq.store(h + mask + 1, memory_order_release);    // free for the next lap's producer
+                return true;
+            }
+        } else if (lap < 0) {
+            return false;                               // not filled yet
+        } else {
+            h = head.load(memory_order_relaxed);
+        }
+    }
+}
+
+void eventbus_t::start() {
+    stopping = false;
+    dispatcher = thread(&eventbus_t::dispatch, this);
+}
+
+void eventbus_t::stop() {
+    if (!dispatcher.joinable()) return;
+    stopping = true;
+    dispatcher.join();
+}
+
+void eventbus_t::dispatch() {
+    gameevent_t ev;
+    while (true) {
+        bool stopNow = stopping.load();                 // read first, so the drain below sees everything
+        bool any = false;
+        while (poll(ev)) {
+            any = true;
+            for (size_t i = 0; i < subscribers.size(); i++) subscribers[i]->onEvent(ev);
+        }
+        if (stopNow) return;
+        if (!any) this_thread::sleep_for(chrono::milliseconds(INPUT_POLL_MS));
+    }
+}
+
+#ifdef __cpp_impl_coroutine
+// ------------------------------- NPC SCRIPTS -------------------------------
+// an NPC's behaviour is one coroutine: it co_awaits act(key) to do something this tick, or
+// until(test) to sleep without being resumed until test holds. the match resumes every script
+// once per tick before combat. frames come out of a per-match block pool, so starting and finishing
+// scripts doesn't hit the heap and suspending/resuming is just a jump
+
+class match_t;
+
+/*
+ * class_identifier: free list of fixed size blocks for coroutine frames, one per match (a match is only
+ *                   ever stepped by one thread at a time). each block starts with a header naming its
+ *                   pool, frames too big for a block go to the heap with a null owner
+ * constructors: framepool_t()
+ * public functions:    void* allocate(size_t size)
+ *                      static void release(void* frame)
+ *                      int inUse() const
+ * static members: BLOCK, CHUNK
+ */
+
+class framepool_t {
+public:
+    framepool_t() {freeList = nullptr; used = 0;}
+    ~framepool_t();
+    void* allocate(size_t size);
+    static void release(void* frame);
+    int inUse() const {return used;}
+    static const size_t BLOCK = 512;    // bytes per block, header included
+    static const int CHUNK = 64;        // blocks carved out per heap allocation
+private:
+    struct alignas(16) header_t {
+        framepool_t* owner;
+        header_t* next;                 // free list link while the block is free
+    };
+    header_t* freeList;
+    vector<char*> chunks;
+    int used;
+};
+
+framepool_t::~framepool_t() {
+    for (size_t i = 0; i < chunks.size(); i++) ::operator delete(chunks[i]);
+}
+
+void* framepool_t::allocate(size_t size) {
+    header_t* b;
+    if (size + sizeof(header_t) > BLOCK) {
+        b = (header_t*)::operator new(size + sizeof(header_t));
+        b->owner = nullptr;
+        return b + 1;
+    }
+    if (freeList == nullptr) {
+        char* chunk = (char*)::operator new(BLOCK * CHUNK);
+        chunks.push_back(chunk);
+        for (int i = CHUNK - 1; i >= 0; i--) {
+            header_t* h = (header_t*)(chunk + i * BLOCK);
+            h->next = freeList;
+            freeList = h;
+        }
+    }
+    b = freeList;
+    freeList = b->next;
+    b->owner = this;
+    used++;
+    return b + 1;
+}
+
+void framepool_t::release(void* frame) {
+    header_t* b = (header_t*)frame - 1;
+    framepool_t* pool = b->owner;
+    if (pool == nullptr) {
+        ::operator delete(b);
+        return;
+    }
+    b->next = pool->freeList;
+    pool->freeList = b;
+    pool->used--;
+}
+
+/*
+ * class_identifier: owns one running NPC script. every script is declared as
+ *                   npctask_t name(match_t& game, int pid) so its frame can be taken from game's pool
+ * constructors: npctask_t(handle_t)
+ * public functions:    bool done() const
+ * static members: none
+ */
+
+class npctask_t {
+public:
+    struct promise_type {
+        int key = 0;                                    // act() - what to do this tick
+        bool (*wait)(match_t&, int) = nullptr;          // until() - don't resume before this holds
+        npctask_t get_return_object() {return npctask_t(coroutine_handle<promise_type>::from_promise(*this));}
+        suspend_always initial_suspend() noexcept {return {};}     // first runs on the next tick
+        suspend_always final_suspend() noexcept {return {};}       // the task destroys the frame
+        void return_void() {}
+        void unhandled_exception() {terminate();}
+        static void* operator new(size_t size, match_t& game, int pid);
+        static void operator delete(void* frame) {framepool_t::release(frame);}
+    };
+    typedef coroutine_handle<promise_type> handle_t;
+    explicit npctask_t(handle_t h) : handle(h) {}
+    npctask_t(npctask_t&& other) noexcept : handle(other.handle) {other.handle = nullptr;}
+    npctask_t& operator=(npctask_t&& other) noexcept;
+    npctask_t(const npctask_t&) = delete;
+    ~npctask_t() {if (handle) handle.destroy();}
+    bool done() const {return !handle || handle.done();}
+    handle_t handle;
+};
+
+npctask_t& npctask_t::operator=(npctask_t&& other) noexcept {
+    if (this != &other) {
+        if (handle) handle.destroy();
+        handle = other.handle;
+        other.handle = nullptr;
+    }
+    return *this;
+}
+
+// co_await act(key): do key this tick, carry on next tick
+struct act_t {
+    int key;
+    bool await_ready() const noexcept {return false;}
+    void await_suspend(npctask_t::handle_t h) const noexcept {h.promise().key = key;}
+    void await_resume() const noexcept {}
+};
+act_t act(int key) {return act_t{key};}
+
+// co_await until(test): sleep, the match checks test each tick and only resumes once it holds
+struct until_t {
+    bool (*test)(match_t&, int);
+    bool await_ready() const noexcept {return false;}
+    void await_suspend(npctask_t::handle_t h) const noexcept {h.promise().wait = test;}
+    void await_resume() const noexcept {}
+};
+until_t until(bool (*test)(match_t&, int)) {return until_t{test};}
+
+/*
+ * class_identifier: the scripts running in one match, at most one per player
+ * constructors: npcs_t()
+ * public functions:    void start(int pid, npctask_t task)
+ *                      void tick(match_t& game)
+ *                      int running() const
+ * static members: none
+ */
+
+class npcs_t {
+public:
+    void start(int pid, npctask_t task);
+    void tick(match_t& game);           // resumes every script that's due and issues its key
+    int running() const;
+    framepool_t pool;                   // declared first so it outlives the frames in tasks
+private:
+    vector<pair<int, npctask_t> > tasks;
+};
+
+#endif
+
+/*
+ * class_identifier: one complete game - map, players, weapons and storm state. nothing in here is
+ *                   shared with another match, so many of them can run side by side on different threads
+ *                   a match points into itself (fov, status array) so it must never be copied
+ * constructors: match_t(int cols, int rows, unsigned int seed)
+ *               match_t(const mapfile_t& layout, unsigned int seed)
+ * public functions:    void command(int pid, int key)
+ *                      void stormStep()
+ *                      void resolveCombat()
+ *                      void emit(int kind, int pid, int x, int y, int value)
+ *                      void markTick()
+ *                      int rewind(int ticks)
+ *                      bool step()
+ *                      bool advanceRound()
+ *                      bool over()
+ *                      int winner()
+ * static members: none
+ */
+
+class match_t {
+public:
+    match_t(int cols, int rows, unsigned int seed);
+    match_t(const mapfile_t& layout, unsigned int seed);    // an authored arena instead of a random one
+    void command(int pid, int key);     // one key from one player, same keys as the local game
+    void stormStep();                   // what enter does: advance the storm, kill whoever it caught
+    void resolveCombat();
+    bool step();                        // one timed tick, returns true once the match is over
+    bool advanceRound();                // ticks up to and through the next storm round
+    bool over() {return numAlive(p) <= 1;}
+    int winner();
+    void blind() {map.fov = nullptr;}   // nobody draws this match (training), stop keeping fields of view
+    void fire(const timerwheel_t::event_t& ev);
+    unsigned int rng;                   // the match's own random state, declared first so map can use it
+    map_t map;
+    world_t world;                      // components of everything below, the objects are its handles
+    player_t p[PLAYERCNT];
+    obstacle_t o[NUM_OF_OBSTACLES];
+    trigger_t shortWep[NUM_SHORT_WEPS];
+    trigger_t longWep[NUM_LONG_WEPS];
+    obstacle_t wall;                    // every authored '@' cell points at this one, it can't be shot down
+#ifdef __cpp_impl_coroutine
+    npcs_t npcs;                        // scripted players, resumed at the start of every step()
+    void scriptPlayers(int first, int last);    // players first..last-1 get an NPC script each
+#endif
+    fov_t fov;
+    flowfield_t flow;                   // shared route toward the safe zone for every agent
+    threatmap_t threat;                 // long range firing lines and storm distance per cell
+    combat_t combat;                    // attacks queued this tick
+    timerwheel_t timers;                // reloads, storm grace, weapon respawns, cooldowns
+    vector<timerwheel_t::event_t> fired;    // scratch for timers.advance()
+    bool* playerStatus;                 // world's player alive column, what every player_t::playerStatus points at
+    bool coolingDown[PLAYERCNT];        // long range weapon fired recently
+    int round;
+    unsigned int tickNo;
+    int workers;                        // threads a storm round may use, hosted matches already get one each
+    bandpool_t bandPool;                // the workers past the match's own thread, started on first use
+    statlog_t* stats;                   // where this match's analytics go, null if nobody's logging
+    eventbus_t* events;                 // where this match's events go, null if nobody's listening
+    int eventId;                        // gameevent_t::match for them
+    void emit(int kind, int pid, int x, int y, int value);
+    void markTick() {if (map.journal != nullptr) map.journal->endTick(tickNo, round);}   // closes the rewind record
+    int rewind(int ticks);              // recorded ticks back, returns how many there were to undo
+private:
+    void logTick();
+    int pickupAt(int x, int y);
+    bool useWeapon(int pid, int slot);
+    void reload(int pid, int slot);
+    void stormDamage();
+    vector<int> stormDepth;             // stormSystem() scratch, one per player
+    vector<int> stormDead;
+    void bindEntities();
+    void initPlayers();
+    void placeLayout(const mapfile_t& layout);
+    void attachViews();
+};
+
+match_t::match_t(int cols, int rows, unsigned int seed) : rng(seed), map(rows, cols, rand_r(&rng)) {
+    bindEntities();
+    initPlayers();
+    spawnEntities(map, p, o, shortWep, longWep, rng);
+    attachViews();
+}
+
+match_t::match_t(const mapfile_t& layout, unsigned int seed)
+    : rng(seed), map(layout.header->rows, layout.header->cols, rand_r(&rng)) {
+    bindEntities();
+    initPlayers();
+    placeLayout(layout);
+    attachViews();
+}
+
+// every entity gets its row, players in pid order
+void match_t::bindEntities() {
+    world.reserve(ARCH_PLAYER, PLAYERCNT);
+    world.reserve(ARCH_OBSTACLE, NUM_OF_OBSTACLES);
+    world.reserve(ARCH_PICKUP, NUM_SHORT_WEPS + NUM_LONG_WEPS);
+    world.reserve(ARCH_WALL, 1);
+    for (int i = 0; i < PLAYERCNT; i++) world.add(ARCH_PLAYER, &p[i]);
+    for (int i = 0; i < NUM_OF_OBSTACLES; i++) world.add(ARCH_OBSTACLE, &o[i]);
+    for (int i = 0; i < NUM_SHORT_WEPS; i++) world.add(ARCH_PICKUP, &shortWep[i]);
+    for (int i = 0; i < NUM_LONG_WEPS; i++) world.add(ARCH_PICKUP, &longWep[i]);
+    for (int i = 0; i < NUM_SHORT_WEPS + NUM_LONG_WEPS; i++) world.weapons(ARCH_PICKUP)[i] = groundWeapon(i);
+    world.add(ARCH_WALL, &wall);
+    playerStatus = world.alive(ARCH_PLAYER);
+}
+
+void match_t::initPlayers() {
+    for (int i = 0; i < PLAYERCNT; i++) {
+        playerStatus[i] = ALIVE;
+        coolingDown[i] = false;
+        p[i].inv().clear();
+        p[i].setPid(i);
+        p[i].playerStatus = playerStatus;
+        p[i].setBounds(map.cols, map.rows);
+    }
+    round = 0;
+    tickNo = 0;
+    workers = 1;
+    stats = nullptr;
+    events = nullptr;
+    eventId = 0;
+}
+
+/*
+ * function_identifier: copies an authored arena onto the grid, reading the lists straight out of the
+ *                      mapping. players without a spawn point get any free cell, the random obstacles
+ *                      and any weapon the file doesn't place stay off the map
+ * parameters: the opened map file
+ * return value: none
+ */
+void match_t::placeLayout(const mapfile_t& layout) {
+    const mapheader_t& h = *layout.header;
+    uint64_t cells = (uint64_t)h.cols * h.rows;     // open() keeps this under MAPFILE_MAX_CELLS
+    if (h.center < cells) map.setCenter(h.center % h.cols, h.center / h.cols);
+    for (uint32_t i = 0; i < h.walls; i++) {
+        if (layout.walls[i] < cells) map.setCell(layout.walls[i] % h.cols, layout.walls[i] / h.cols, &wall);
+    }
+    for (int i = 0; i < NUM_LONG_WEPS; i++)
+        longWep[i].setSymbol('!');
+    for (int i = 0; i < NUM_SHORT_WEPS + NUM_LONG_WEPS; i++) {
+        trigger_t* w = i < NUM_SHORT_WEPS ? &shortWep[i] : &longWep[i - NUM_SHORT_WEPS];
+        uint32_t cell = i < NUM_SHORT_WEPS ? (i < (int)h.shortWeps ? layout.shortWeps[i] : NO_CELL)
+                                           : (i - NUM_SHORT_WEPS < (int)h.longWeps ? layout.longWeps[i - NUM_SHORT_WEPS] : NO_CELL);
+        if (cell >= cells || map.at(cell % h.cols, cell / h.cols) != nullptr) continue;
+        w->pos() = coord_t(cell % h.cols, cell / h.cols);
+        map.dynAddEnt(w, w->pos());
+    }
+
+    cellsampler_t spots((int)cells, rng);
+    for (int i = 0; i < PLAYERCNT; i++) {
+        uint32_t cell = i < (int)h.spawns ? layout.spawns[i] : NO_CELL;
+        if (cell >= cells || map.at(cell % h.cols, cell / h.cols) != nullptr) {
+            int pick;
+            cell = NO_CELL;
+            while (cell == NO_CELL && spots.next(pick)) {
+                if (map.at(pick % h.cols, pick / h.cols) == nullptr) cell = pick;
             }
         }
-        for (int i = 0; i< PLAYERCNT; i++) {
-            if (map.egrid[p.pos.y][p.pos.x+1] == (&p+i)) {
-                player = true;
-            }
+        if (cell == NO_CELL) {
+            p[i].removePlayer();            // the arena is full
+            continue;
         }
-        if (!obstacle && !player) {
-            for (int i = 0; i < NUM_SHORT_WEPS; i++) {
-                if (map.egrid[p.pos.y][p.pos.x+1] == (shortWep+i)){
-                    haveShort = true;
-                    break;
-                }
-            }
-            for (int i = 0; i < NUM_LONG_WEPS; i++) {
-                if (map.egrid[p.pos.y][p.pos.x+1] == (longWep+i)){
-                    haveLong = true;
-                    break;
-                }
-            }
-            p.moveRight();
-            updatePos(map, p);
+        p[i].pos() = coord_t(cell % h.cols, cell / h.cols);
+        map.dynAddEnt(&(p[i]), p[i].pos());
+    }
+}
+
+void match_t::attachViews() {
+    fov.init(&map, p, PLAYERCNT);
+    map.fov = &fov;
+    flow.init(&map);
+    map.flow = &flow;
+    threat.init(&map, p, world.inventories(ARCH_PLAYER), PLAYERCNT);
+    map.threat = &threat;
+}
+
+void match_t::command(int pid, int key) {
+    if (playerStatus[pid] == DEAD) return;
+    if (key == 'f') {
+        if (useWeapon(pid, SLOT_SHORT)) combat.queue(pid, key);
+    } else if (combat_t::isAttack(key)) {
+        if (!coolingDown[pid] && useWeapon(pid, SLOT_LONG)) {
+            combat.queue(pid, key);
+            coolingDown[pid] = true;
+            timers.schedule(LONG_COOLDOWN_TICKS, TIMER_COOLDOWN, pid);
         }
-    } else if (direction == 97) {                                       // checking A
-        for (int i = 0; i < NUM_OF_OBSTACLES; i++){
-            if (map.egrid[p.pos.y][p.pos.x - 1] == (o+i)) {
-                obstacle = true;
-            }
+    } else if (key == 'r') {
+        for (int slot = 0; slot < INVENTORY_SLOTS; slot++) reload(pid, slot);
+    } else {
+        int x = p[pid].pos().x, y = p[pid].pos().y;
+        int tx = x + (key == 'd') - (key == 'a');
+        int ty = y + (key == 's') - (key == 'w');
+        if ((tx != x || ty != y) && map.isOpaque(tx, ty)) return;  // rubble, authored walls and the edge
+        int item = pickupAt(tx, ty);
+        makemove(map, p, pid, o, key);
+        if (item < 0 || p[pid].pos().x != tx || p[pid].pos().y != ty) return;
+        int slot = item < NUM_SHORT_WEPS ? SLOT_SHORT : SLOT_LONG;     // picked a weapon up, it'll be back
+        p[pid].inv().take(slot, world.weapons(ARCH_PICKUP)[item]);
+        timers.schedule(WEAPON_RESPAWN_TICKS, TIMER_RESPAWN, item);
+        if (stats) stats->record(tickNo, slot == SLOT_SHORT ? STAT_SHORT_PICKUP : STAT_LONG_PICKUP, pid, tx, ty);
+        emit(EVENT_PICKUP, pid, tx, ty, slot);
+    }
+}
+
+// publishes one event if anyone's listening, never waits
+void match_t::emit(int kind, int pid, int x, int y, int value) {
+    if (events == nullptr) return;
+    gameevent_t ev;
+    ev.tick = tickNo;
+    ev.match = eventId;
+    ev.kind = kind;
+    ev.pid = pid;
+    ev.x = x;
+    ev.y = y;
+    ev.value = value;
+    events->publish(ev);
+}
+
+void match_t::resolveCombat() {
+    combat.resolve(map, world);
+    if (events == nullptr) return;
+    const vector<pair<int, int> >& hurt = combat.hurt();
+    for (size_t i = 0; i < hurt.size(); i++)
+        emit(EVENT_DAMAGE, hurt[i].first, p[hurt[i].first].pos().x, p[hurt[i].first].pos().y, hurt[i].second);
+    const vector<pair<int, bool> >& shot = combat.killed();
+    for (size_t i = 0; i < shot.size(); i++)
+        emit(EVENT_KILL, shot[i].first, p[shot[i].first].pos().x, p[shot[i].first].pos().y,
+             shot[i].second ? STAT_LONG_DEATH : STAT_SHORT_DEATH);
+}
+
+// the pickup row lying on a cell, -1 if there's none. the grid cell already holds the pickup's handle,
+// so this is one lookup however many weapons are lying around
+int match_t::pickupAt(int x, int y) {
+    ent_t* cell = map.at(x, y);
+    if (cell == nullptr || cell->getWorld() != &world || cell->getArch() != ARCH_PICKUP) return -1;
+    return cell->getRow();
+}
+
+// spends a round of the weapon in slot, an empty magazine starts reloading instead
+bool match_t::useWeapon(int pid, int slot) {
+    inventory_t& inv = p[pid].inv();
+    if (inv.use(slot)) return true;
+    if (inv.has(slot) && inv.get(slot).getMagAmmo() == 0) reload(pid, slot);
+    return false;
+}
+
+void match_t::reload(int pid, int slot) {
+    inventory_t& inv = p[pid].inv();
+    if (!inv.has(slot) || inv.get(slot).isReloading()) return;
+    inv.get(slot).reload();
+    if (inv.get(slot).isReloading()) timers.schedule(RELOAD_TICKS, TIMER_RELOAD, pid, slot);
+}
+
+/*
+ * function_identifier: runs whatever a timer scheduled
+ * parameters: the event that came due
+ * return value: none
+ */
+void match_t::fire(const timerwheel_t::event_t& ev) {
+    if (ev.kind == TIMER_RELOAD) {
+        p[ev.a].inv().get(ev.b).finishReload();
+    } else if (ev.kind == TIMER_COOLDOWN) {
+        coolingDown[ev.a] = false;
+    } else if (ev.kind == TIMER_STORM_GRACE) {
+        if (hitIndex(map.at(ev.a, ev.b), world) >= NUM_OF_OBSTACLES) timers.schedule(STORM_GRACE_TICKS, TIMER_STORM_GRACE, ev.a, ev.b);
+        else map.setCell(ev.a, ev.b, &map);             // nobody's standing there any more, the storm takes the cell
+    } else if (ev.kind == TIMER_RESPAWN) {
+        trigger_t* w = ev.a < NUM_SHORT_WEPS ? &shortWep[ev.a] : &longWep[ev.a - NUM_SHORT_WEPS];
+        ent_t* cell = map.at(w->pos().x, w->pos().y);
+        if (cell == &map) return;                       // the storm ate the spawn point
+        if (cell == nullptr || cell == &e) {
+            world.weapons(ARCH_PICKUP)[ev.a] = groundWeapon(ev.a);     // a fresh one, full magazine
+            map.setCell(w->pos().x, w->pos().y, w);
+        } else timers.schedule(STORM_TICKS, TIMER_RESPAWN, ev.a);    // someone's standing there, try later
+    }
+}
+
+void match_t::stormStep() {
+    update(map, &map, p, timers, bandPool, workers);
+    flow.invalidate();                  // storm cells changed, the field is rebuilt once per round
+    if (stats) stats->record(tickNo, STAT_STORM, 0, std::max(map.radius, 0), round);
+    emit(EVENT_STORM, 0, map.centerCoord.x, map.centerCoord.y, std::max(map.radius, 0));
+    emit(EVENT_ROUND_END, 0, 0, 0, round);
+    round++;
+}
+
+/*
+ * function_identifier: storm damage for this tick. each shard only touches its own rows, then the
+ *                      deaths are handed to the grid (the storm takes the cell) in row order
+ * parameters: none
+ * return value: none
+ */
+void match_t::stormDamage() {
+    const coord_t& c = map.centerCoord;
+    int players = world.count(ARCH_PLAYER);
+    int shards = std::max(1, std::min(workers, players / STATUS_BAND_PLAYERS));
+    int died[PLAYERCNT];
+    stormDepth.resize(players);         // no-ops after the first tick
+    stormDead.resize(players);
+    bandPool.run(shards, [&](int b) {
+        int first = players * b / shards;
+        died[b] = stormSystem(world, ARCH_PLAYER, c.x - map.dXL, c.x + map.dXR, c.y - map.dYU, c.y + map.dYB,
+                              first, players * (b + 1) / shards, stormDepth.data(), stormDead.data());
+    });
+    for (int b = 0; b < shards; b++) {
+        int first = players * b / shards;
+        for (int k = first; k < first + died[b]; k++) {
+            const coord_t& at = p[stormDead[k]].pos();
+            map.setCell(at.x, at.y, &map);
+            if (stats) stats->record(tickNo, STAT_STORM_DEATH, stormDead[k], at.x, at.y);
+            emit(EVENT_KILL, stormDead[k], at.x, at.y, STAT_STORM_DEATH);
         }
-        for (int i = 0; i< PLAYERCNT; i++) {
-            if (map.egrid[p.pos.y][p.pos.x - 1] == (&p+i)) {
-                player = true;
+    }
+}
+
+bool match_t::step() {
+#ifdef __cpp_impl_coroutine
+    npcs.tick(*this);                   // scripted players pick their keys like everyone else
+#endif
+    resolveCombat();                    // everything attacked during the tick lands at once
+    tickNo++;
+    fired.clear();
+    timers.advance(fired);              // only touches timers that are due
+    for (size_t i = 0; i < fired.size(); i++) fire(fired[i]);
+    if (tickNo % STORM_TICKS == 0) stormStep();
+    stormDamage();
+    if (map.fov != nullptr) fov.refresh();
+    flow.refresh();
+    threat.sync();
+    p[0].chooseLastAlive(rng);
+    if (stats) logTick();
+    markTick();
+    if (!over()) return false;
+    emit(EVENT_VICTORY, winner(), 0, 0, 0);
+    return true;
+}
+
+// everyone's position this tick, straight from the position column, plus who got shot
+void match_t::logTick() {
+    const vector<pair<int, bool> >& shot = combat.killed();
+    for (size_t i = 0; i < shot.size(); i++) {
+        const coord_t& at = p[shot[i].first].pos();
+        stats->record(tickNo, shot[i].second ? STAT_LONG_DEATH : STAT_SHORT_DEATH, shot[i].first, at.x, at.y);
+    }
+    const coord_t* pos = world.pos(ARCH_PLAYER);
+    for (int i = 0; i < PLAYERCNT; i++)
+        if (playerStatus[i] == ALIVE) stats->record(tickNo, STAT_POS, i, pos[i].x, pos[i].y);
+}
+
+// the records are undone back to back and the fields are brought up to date once at the end,
+// the flow field is only rebuilt if any side of the safe rectangle came back different
+int match_t::rewind(int ticks) {
+    int storm[5] = {map.dXR, map.dXL, map.dYU, map.dYB, map.radius}, undone = 0;    // in rewind_t's order
+    while (undone < ticks && map.journal != nullptr && map.journal->undo(tickNo, round)) undone++;
+    if (undone == 0) return 0;
+    if (storm[0] != map.dXR || storm[1] != map.dXL || storm[2] != map.dYU || storm[3] != map.dYB || storm[4] != map.radius)
+        flow.invalidate();
+    threat.sync();
+    if (map.fov != nullptr) fov.refresh();
+    flow.refresh();
+    p[0].chooseLastAlive(rng);
+    return undone;
+}
+
+// enter in the local game: the rest of this storm round at once, on top of the tick every key runs
+bool match_t::advanceRound() {
+    bool finished;
+    do {
+        finished = step();
+    } while (!finished && tickNo % STORM_TICKS != 0);
+    return finished;
+}
+
+int match_t::winner() {
+    return numAlive(p) == 1 ? whoAlive(p) : p[0].lastAlive;
+}
+
+/*
+ * function_identifier: checks that players passing through the storm don't punch holes in it: player 0
+ *                      steps onto a storm cell and back off, then steps on again and dies there, and the
+ *                      cell has to read as storm both times
+ * parameters: none
+ * return value: 0 if the storm held, 1 otherwise
+ */
+int stormCheck() {
+    match_t game(30, 12, 1);
+    game.blind();
+    map_t& map = game.map;
+    for (int i = 0; i < 4; i++) game.stormStep();
+    int sx = -1, sy = -1;                   // a storm cell with open, safe ground to its right
+    for (int y = 0; y < map.rows && sx < 0; y++) {
+        for (int x = 0; x + 1 < map.cols && sx < 0; x++) {
+            ent_t* next = map.at(x + 1, y);
+            if (map.at(x, y) == &map && (next == nullptr || next == &e) && leftBehind(map, x + 1, y) == &e) {
+                sx = x;
+                sy = y;
             }
         }
-        if (!obstacle && !player){
-            for (int i = 0; i < NUM_SHORT_WEPS; i++) {
-                if (map.egrid[p.pos.y][p.pos.x-1] == (shortWep+i)){
-                    haveShort = true;
-                    break;
-                }
-            }
-            for (int i = 0; i < NUM_LONG_WEPS; i++) {
-                if (map.egrid[p.pos.y][p.pos.x-1] == (longWep+i)){
-                    haveLong = true;
-                    break;
-                }
-            }
-            p.moveLeft();
-            updatePos(map, p);
-        }
-    } else if (direction == 102 && haveShort) {
-        for (int i = 0; i < NUM_OF_OBSTACLES; i++){
-            // if the obstacle is above, below, left, or right of us
-            
-            if (map.egrid[p.pos.y-1][p.pos.x] == (o+i)){            // OBS is ABOVE US
-                if ((o+i)->hp.gethp()>0){
-                    (o+i)->hp.sethp((o+i)->hp.gethp() - 20);        // decrease the hp by 10 of that obstacle
-                    break;
-                } else {
-                    map.egrid[p.pos.y-1][p.pos.x] = nullptr;        // make it not point to anything(delete the obstacle)
-                    break;
-                } 
-            }   
-            else if (map.egrid[p.pos.y+1][p.pos.x] == (o+i)) {      // OBS is BELOW US
-                if ((o+i)->hp.gethp()>0){
-                    (o+i)->hp.sethp((o+i)->hp.gethp() - 20);        // decrease the hp by 10 of that obstacle
-                    break;
-                } else {
-                    map.egrid[p.pos.y+1][p.pos.x] = nullptr;        // make it not point to anything(delete the obstacle)
-                    break;
-                } 
-            }
-            else if (map.egrid[p.pos.y][p.pos.x - 1] == (o+i)) {    // OBS is LEFT of US
-                if ((o+i)->hp.gethp()>0){
-                    (o+i)->hp.sethp((o+i)->hp.gethp() - 20);        // decrease the hp by 10 of that obstacle
-                    break;
-                } else {
-                    map.egrid[p.pos.y][p.pos.x - 1] = nullptr;        // make it not point to anything(delete the obstacle)
-                    break;
-                } 
-            } 
-            else if (map.egrid[p.pos.y][p.pos.x + 1] == (o+i)) {
-                if ((o+i)->hp.gethp()>0){
-                    (o+i)->hp.sethp((o+i)->hp.gethp() - 20);        // decrease the hp by 10 of that obstacle
-                    break;
-                } else {
-                    map.egrid[p.pos.y][p.pos.x + 1] = nullptr;        // make it not point to anything(delete the obstacle)
-                    break;
-                } 
-            } 
-            
-            else {
-                continue;
-            }
+    }
+    if (sx < 0) {
+        cerr << "no storm edge to walk through" << endl;
+        return 1;
+    }
+    player_t& p = game.p[0];
+    coord_t from = p.pos();
+    p.pos() = coord_t(sx + 1, sy);
+    updatePos(map, p, from);
+    game.command(0, 'a');                   // into the storm
+    bool entered = p.pos().x == sx;
+    game.command(0, 'd');                   // and back out
+    bool walked = entered && p.pos().x == sx + 1 && map.at(sx, sy) == &map;
+    game.command(0, 'a');
+    p.hp().sethp(0);                        // the storm's next tick finishes it off
+    game.step();
+    bool died = game.playerStatus[0] == DEAD && map.at(sx, sy) == &map;
+    cout << "walking through the storm: " << (walked ? "ok" : "FAILED")
+         << ", dying in it: " << (died ? "ok" : "FAILED") << endl;
+    return walked && died ? 0 : 1;
+}
+
+#ifdef __cpp_impl_coroutine
+void* npctask_t::promise_type::operator new(size_t size, match_t& game, int /*pid*/) {
+    return game.npcs.pool.allocate(size);
+}
+
+void npcs_t::start(int pid, npctask_t task) {
+    tasks.push_back(make_pair(pid, std::move(task)));
+}
+
+int npcs_t::running() const {
+    int n = 0;
+    for (size_t i = 0; i < tasks.size(); i++) n += !tasks[i].second.done();
+    return n;
+}
+
+void npcs_t::tick(match_t& game) {
+    for (size_t i = 0; i < tasks.size(); i++) {
+        int pid = tasks[i].first;
+        npctask_t& task = tasks[i].second;
+        if (task.done()) continue;
+        if (game.playerStatus[pid] == DEAD) {
+            task = npctask_t(nullptr);          // the frame goes back to the pool
+            continue;
         }
+        npctask_t::promise_type& promise = task.handle.promise();
+        if (promise.wait != nullptr && !promise.wait(game, pid)) continue;
+        promise.wait = nullptr;
+        promise.key = 0;
+        task.handle.resume();
+        if (promise.key != 0) game.command(pid, promise.key);
+    }
+}
 
-        // ------------------------------- PLAYERS -------------------------------
-        for (int i = 0; i < PLAYERCNT; i++){
-            // if the obstacle is above, below, left, or right of us
-            if (map.egrid[p.pos.y-1][p.pos.x] == (&p+i)){            // PLAYER is ABOVE US
-                if ((&p+i)->hp.gethp()>0){
-                    (&p+i)->hp.sethp((&p+i)->hp.gethp() - 20);        // decrease the hp by 10 of that obstacle
-                    break;
-                } else {
-                    (&p+i)->removePlayer();
-                    map.egrid[p.pos.y-1][p.pos.x] = &e;        // make it not point to anything(delete the obstacle)
-                    
-                    break;
-                } 
-            }   
-            else if (map.egrid[p.pos.y+1][p.pos.x] == (&p+i)) {      // PLAYER is BELOW US
-                if ((&p+i)->hp.gethp()>0){
-                    (&p+i)->hp.sethp((&p+i)->hp.gethp() - 20);        // decrease the hp by 10 of that obstacle
-                    break;
-                } else {
-                    (&p+i)->removePlayer();
-                    map.egrid[p.pos.y+1][p.pos.x] = &e;        // make it not point to anything(delete the obstacle)
-                         // make it not point to anything(delete the obstacle)
-                    
-                    break;
-                } 
-            }
-            else if (map.egrid[p.pos.y][p.pos.x - 1] == (&p+i)) {    // PLAYER is LEFT of US
-                if ((&p+i)->hp.gethp()>0){
-                    (&p+i)->hp.sethp((&p+i)->hp.gethp() - 20);        // decrease the hp by 10 of that obstacle
-                    break;
-                } else {
-                    (&p+i)->removePlayer();
-                    map.egrid[p.pos.y][p.pos.x - 1] = &e;        // make it not point to anything(delete the obstacle)
-                    
-                    break;
-                } 
-            } 
-            else if (map.egrid[p.pos.y][p.pos.x + 1] == (&p+i)) {
-                if ((&p+i)->hp.gethp()>0){
-                    (&p+i)->hp.sethp((&p+i)->hp.gethp() - 20);        // decrease the hp by 10 of that obstacle
-                    
-                    break;
-                } else {
-                    (&p+i)->removePlayer();
-                    map.egrid[p.pos.y][p.pos.x + 1] = &e;        // make it not point to anything(delete the obstacle)
-                    
-                    break;
-                } 
-            } else {
-                continue;
-            }
+// one step from pid toward (tx, ty), along the longer axis first, 0 if there's no free step closer
+int stepToward(match_t& game, int pid, int tx, int ty) {
+    int x = game.p[pid].pos().x, y = game.p[pid].pos().y;
+    int dx = tx - x, dy = ty - y;
+    int horizontal = dx > 0 ? 'd' : 'a';
+    int vertical = dy > 0 ? 's' : 'w';
+    int order[2] = {abs(dx) >= abs(dy) ? horizontal : vertical, abs(dx) >= abs(dy) ? vertical : horizontal};
+    for (int i = 0; i < 2; i++) {
+        if ((order[i] == horizontal && dx == 0) || (order[i] == vertical && dy == 0)) continue;
+        int nx = x + (order[i] == 'd') - (order[i] == 'a');
+        int ny = y + (order[i] == 's') - (order[i] == 'w');
+        ent_t* cell = game.map.at(nx, ny);
+        if (game.map.isOpaque(nx, ny) || (cell != nullptr && cell != &e && cell->cprint() >= 'A' && cell->cprint() <= 'Z'))
+            continue;                           // walls, rubble and other players
+        return order[i];
+    }
+    return 0;
+}
+
+// the closest short range weapon still lying on the map, false if there is none
+bool nearestShortWeapon(match_t& game, int pid, int& tx, int& ty) {
+    int best = -1;
+    for (int i = 0; i < NUM_SHORT_WEPS; i++) {
+        trigger_t& w = game.shortWep[i];
+        if (game.map.at(w.pos().x, w.pos().y) != &w) continue;
+        int d = abs(w.pos().x - game.p[pid].pos().x) + abs(w.pos().y - game.p[pid].pos().y);
+        if (best < 0 || d < best) {best = d; tx = w.pos().x; ty = w.pos().y;}
+    }
+    return best >= 0;
+}
+
+int nearestEnemy(match_t& game, int pid) {
+    int best = -1, who = -1;
+    for (int i = 0; i < PLAYERCNT; i++) {
+        if (i == pid || game.playerStatus[i] == DEAD) continue;
+        int d = abs(game.p[i].pos().x - game.p[pid].pos().x) + abs(game.p[i].pos().y - game.p[pid].pos().y);
+        if (best < 0 || d < best) {best = d; who = i;}
+    }
+    return who;
+}
+
+const int STORM_FLEE_STEPS = 3;         // scripts give up whatever they're doing this close to the storm
+
+bool stormClose(match_t& game, int pid) {
+    return game.threat.stormDistance(game.p[pid].pos().x, game.p[pid].pos().y) <= STORM_FLEE_STEPS;
+}
+
+/*
+ * function_identifier: NPC script - walk to the nearest '#', then hunt the nearest player, and once the
+ *                      storm gets close run from it toward the safe zone for good
+ * parameters: the match, pid being scripted
+ * return value: the running script
+ */
+npctask_t raider(match_t& game, int pid) {
+    int tx, ty;
+    while (!game.p[pid].inv().has(SLOT_SHORT) && !stormClose(game, pid) && nearestShortWeapon(game, pid, tx, ty)) {
+        int key = stepToward(game, pid, tx, ty);
+        co_await act(key != 0 ? key : "wasd"[rand_r(&game.rng) % 4]);    // stuck, shuffle sideways
+    }
+    while (!stormClose(game, pid)) {
+        int target = nearestEnemy(game, pid);
+        if (target < 0) break;
+        player_t& t = game.p[target];
+        if (abs(t.pos().x - game.p[pid].pos().x) + abs(t.pos().y - game.p[pid].pos().y) == 1 && game.p[pid].inv().has(SLOT_SHORT))
+            co_await act('f');
+        else
+            co_await act(stepToward(game, pid, t.pos().x, t.pos().y));
+    }
+    while (true) {
+        const player_t& me = game.p[pid];
+        co_await act(game.flow.nextKey(me.pos().x, me.pos().y));
+    }
+}
+
+/*
+ * function_identifier: NPC script - stays hidden without even being resumed until the storm is close,
+ *                      then heads for the safe zone, shooting anyone lined up with it on the way
+ * parameters: the match, pid being scripted
+ * return value: the running script
+ */
+npctask_t camper(match_t& game, int pid) {
+    co_await until(stormClose);
+    while (true) {
+        const player_t& me = game.p[pid];
+        int target = nearestEnemy(game, pid);
+        if (game.p[pid].inv().has(SLOT_LONG) && target >= 0 && !game.coolingDown[pid]) {
+            const player_t& t = game.p[target];
+            if (t.pos().x == me.pos().x) {co_await act(t.pos().y < me.pos().y ? 'u' : 'j'); continue;}
+            if (t.pos().y == me.pos().y) {co_await act(t.pos().x < me.pos().x ? 'h' : 'k'); continue;}
         }
+        co_await act(game.flow.nextKey(me.pos().x, me.pos().y));
     }
-    else if (direction == 117 && haveLong) {             // checking that player has a long range weapon
-        bool foundObs = false;
-        bool foundPlayer = false;
-        for (int i = p.pos.y; i >= 1; i--) {                // CHECKING OBSTACLE ABOVE
-            for (int j = 0; j < NUM_OF_OBSTACLES; j++){
-                if (map.egrid[i][p.pos.x] == (o+j)) {        // if there is an obstacle ANYWHERE above the player
-                    map.egrid[i][p.pos.x] = &e;
-                    foundObs = true;
-                    break;
-                }   
-                if (i==1 && map.egrid[i-1][p.pos.x] == (o+j)){
-                    map.egrid[i-1][p.pos.x] = &e;
-                    foundObs = true;
+}
+
+// even pids camp, odd pids raid
+void match_t::scriptPlayers(int first, int last) {
+    for (int i = first; i < last && i < PLAYERCNT; i++)
+        npcs.start(i, i % 2 ? raider(*this, i) : camper(*this, i));
+}
+#endif
+
+// ------------------------------- NETWORKING -------------------------------
+// wire format, server -> client: [u8 type][varint length][payload]
+//      MSG_HELLO   u8 pid (255 = spectator), varint cols, varint rows
+//      MSG_FULL    RLE grid: (varint run, u8 glyph) pairs, sent once on join
+//      MSG_DELTA   varint tick, varint nCells, nCells * (varint index gap, u8 glyph),
+//                  varint nPlayers, nPlayers * (u8 pid, u8 status), u64 grid hash (little endian)
+//      MSG_END     u8 winner pid
+// client -> server: raw key bytes, the same keys the local game uses
+
+const int MSG_HELLO = 1;
+const int MSG_FULL = 2;
+const int MSG_DELTA = 3;
+const int MSG_END = 4;
+const int MAX_QUEUED_KEYS = 64;     // type-ahead kept per client, extra keys are dropped
+const int MAX_CLIENT_BACKLOG = 1 << 20; // clients that fall this far behind get disconnected
+const int STATE_CACHE_SLOTS = 64;   // grid states whose full frame the server keeps around
+
+void putVarint(string& out, unsigned int v) {
+    while (v >= 0x80) {
+        out += (char)((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+// returns false if the buffer ends in the middle of the varint
+bool getVarint(const string& in, size_t& at, unsigned int& v) {
+    v = 0;
+    for (int shift = 0; at < in.size() && shift < 35; shift += 7) {
+        unsigned char b = in[at++];
+        v |= (unsigned int)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+void putFrame(string& out, int type, const string& payload) {
+    out += (char)type;
+    putVarint(out, payload.size());
+    out += payload;
+}
+
+/*
+ * function_identifier: opens a listening or connected socket for "port" (tcp on 127.0.0.1)
+ *                      or "path" (unix socket)
+ * parameters: address string, true to listen, false to connect
+ * return value: fd, or -1 on failure
+ */
+int openSocket(const char* addr, bool listening) {
+    bool isPort = addr[0] != '\0';
+    for (const char* c = addr; *c; c++) if (*c < '0' || *c > '9') isPort = false;
+
+    int fd;
+    if (isPort) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(atoi(addr));
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);   // localhost only
+        int rc = listening ? bind(fd, (sockaddr*)&sa, sizeof(sa)) : connect(fd, (sockaddr*)&sa, sizeof(sa));
+        if (rc < 0) {close(fd); return -1;}
+    } else {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strncpy(sa.sun_path, addr, sizeof(sa.sun_path) - 1);
+        if (listening) unlink(addr);                    // stale socket from an earlier run
+        int rc = listening ? bind(fd, (sockaddr*)&sa, sizeof(sa)) : connect(fd, (sockaddr*)&sa, sizeof(sa));
+        if (rc < 0) {close(fd); return -1;}
+    }
+    if (listening && listen(fd, 64) < 0) {close(fd); return -1;}
+    return fd;
+}
+
+/*
+ * class_identifier: what was built for a grid state, keyed by the grid's zobrist hash. direct mapped,
+ *                   a new state simply takes over its slot, so lookups and stores are one probe each.
+ *                   a hit also has to match the state's check hash, so two grids only get mixed up if
+ *                   both 64 bit hashes collide at once
+ * constructors: statecache_t(int slots)
+ * public functions:    const string* find(unsigned long long hash, unsigned long long check) const
+ *                      void put(unsigned long long hash, unsigned long long check, const string& value)
+ * static members: none
+ */
+
+class statecache_t {
+public:
+    explicit statecache_t(int slots) : keys(slots, 0), checks(slots, 0), used(slots, false), values(slots) {}
+    const string* find(unsigned long long hash, unsigned long long check) const;  // null if that state isn't cached
+    void put(unsigned long long hash, unsigned long long check, const string& value);
+private:
+    vector<unsigned long long> keys;
+    vector<unsigned long long> checks;
+    vector<bool> used;
+    vector<string> values;
+};
+
+const string* statecache_t::find(unsigned long long hash, unsigned long long check) const {
+    size_t i = hash % keys.size();
+    return used[i] && keys[i] == hash && checks[i] == check ? &values[i] : nullptr;
+}
+
+void statecache_t::put(unsigned long long hash, unsigned long long check, const string& value) {
+    size_t i = hash % keys.size();
+    keys[i] = hash;
+    checks[i] = check;
+    used[i] = true;
+    values[i] = value;
+}
+
+/*
+ * class_identifier: authoritative game server. runs the tick loop, owns the only copy of the game
+ *                   and streams per-tick deltas to every connected client from one epoll loop
+ * constructors: server_t(match_t&)
+ * public functions:    bool open(const char* addr)
+ *                      int run()
+ * static members: none
+ */
+
+class server_t {
+public:
+    server_t(match_t& m);
+    bool open(const char* addr);
+    int run();                          // returns when someone wins
+private:
+    struct client_t {
+        int fd;
+        int pid;                        // player controlled, -1 for spectators
+        string in;                      // keys not yet applied, one per tick
+        string out;                     // bytes the socket hasn't taken yet
+        bool wantWrite;                 // EPOLLOUT armed
+    };
+    void accept();
+    void readFrom(client_t& c);
+    void flush(client_t& c);
+    void drop(int fd);
+    void tick();
+    string fullFrame();
+    string deltaFrame(const vector<int>& cells, const string& ents);
+    match_t& game;
+    map_t& map;
+    player_t* p;
+    int listenFd;
+    int epfd;
+    int timerFd;
+    bool over;
+    bool taken[PLAYERCNT];              // pid already controlled by a client
+    bool lastStatus[PLAYERCNT];         // what clients were last told
+    vector<client_t> clients;
+    vector<int> cells;                  // scratch for takeChanges()
+    statecache_t joins;                 // full frames by grid hash, clients joining the same state share one
+};
+
+server_t::server_t(match_t& m) : game(m), map(m.map), p(m.p), joins(STATE_CACHE_SLOTS) {
+    listenFd = epfd = timerFd = -1;
+    over = false;
+    for (int i = 0; i < PLAYERCNT; i++) {
+        taken[i] = false;
+        lastStatus[i] = p[0].playerStatus[i];
+    }
+    map.trackChanges();
+}
+
+bool server_t::open(const char* addr) {
+    listenFd = openSocket(addr, true);
+    if (listenFd < 0) return false;
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    itimerspec ts;
+    ts.it_interval.tv_sec = ts.it_value.tv_sec = 0;
+    ts.it_interval.tv_nsec = ts.it_value.tv_nsec = TICK_MS * 1000000L;
+    timerfd_settime(timerFd, 0, &ts, nullptr);
+
+    epfd = epoll_create1(0);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.data.fd = timerFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &ev);
+    return epfd >= 0 && timerFd >= 0;
+}
+
+int server_t::run() {
+    epoll_event events[64];
+    while (!over) {
+        int n = epoll_wait(epfd, events, 64, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return 1;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd) {
+                accept();
+            } else if (fd == timerFd) {
+                uint64_t expirations;
+                if (read(timerFd, &expirations, sizeof(expirations)) > 0) tick();
+            } else {
+                for (size_t j = 0; j < clients.size(); j++) {
+                    if (clients[j].fd != fd) continue;
+                    if (events[i].events & (EPOLLHUP | EPOLLERR)) {drop(fd); break;}
+                    if (events[i].events & EPOLLIN) readFrom(clients[j]);
+                    // readFrom() may have dropped the client
+                    if (j < clients.size() && clients[j].fd == fd && (events[i].events & EPOLLOUT)) flush(clients[j]);
                     break;
                 }
-                if (foundObs) break;                               // break out of double for loop
-            }
-            if (foundObs) break;  
-            for (int j = 0; j < PLAYERCNT; j++){
-                if (map.egrid[i-1][p.pos.x] == (&p+j)) {        // if there is an player ANYWHERE above the player
-                    (&p+j)->removePlayer();
-                    map.egrid[i-1][p.pos.x] = &e;
-                    foundPlayer = true;
-                    break;
-                }   
-                if (foundPlayer) break;                               // break out of double for loop
             }
-            if (foundPlayer) break;   
         }
-    } else if (direction == 106 && haveLong) {                // BELOW
-        bool foundObs = false;
-        bool foundPlayer = false;
+    }
+    for (size_t i = 0; i < clients.size(); i++) close(clients[i].fd);
+    close(listenFd);
+    close(timerFd);
+    close(epfd);
+    return 0;
+}
 
-         for (int i = p.pos.y; i <= (GRIDY-2); i++) {             // CHECKING OBSTACLE
-            for (int j = 0; j < NUM_OF_OBSTACLES; j++){
-                if (map.egrid[i][p.pos.x] == (o+j)) {        // if there is an obstacle ANYWHERE above the player
-                    map.egrid[i][p.pos.x] = &e;
-                    foundObs = true;
-                    break;
-                }
-                if (i==(GRIDY-1) && map.egrid[i+1][p.pos.x] == (o+j)){
-                    map.egrid[i+1][p.pos.x] = &e;
-                    foundObs = true;
-                    break;
-                }   
-                if (foundObs) break;                            // break out of double for loop
+// new clients get the lowest free living player, or spectate when none are left
+void server_t::accept() {
+    int fd;
+    while ((fd = ::accept(listenFd, nullptr, nullptr)) >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        client_t c;
+        c.fd = fd;
+        c.pid = -1;
+        c.wantWrite = false;
+        for (int i = 0; i < PLAYERCNT; i++) {
+            if (!taken[i] && p[0].playerStatus[i] == ALIVE) {
+                taken[i] = true;
+                c.pid = i;
+                break;
             }
-            if (foundObs) break;
-             for (int j = 0; j < PLAYERCNT; j++){
-                if (map.egrid[i+1][p.pos.x] == (&p+j)) {        // if there is an player ANYWHERE above the player
-                    (&p+j)->removePlayer();
-                    map.egrid[i+1][p.pos.x] = &e;
-                    foundPlayer = true;
-                    break;
-                }   
-                if (foundPlayer) break;                               // break out of double for loop
+        }
+        string hello;
+        hello += (char)(c.pid < 0 ? 255 : c.pid);
+        putVarint(hello, map.cols);
+        putVarint(hello, map.rows);
+        putFrame(c.out, MSG_HELLO, hello);
+        c.out += fullFrame();
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        clients.push_back(c);
+        flush(clients.back());
+    }
+}
+
+void server_t::readFrom(client_t& c) {
+    char buf[256];
+    int fd = c.fd;
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {drop(fd); return;}
+        if (n < 0) return;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == 'q') {drop(fd); return;}
+            if ((int)c.in.size() < MAX_QUEUED_KEYS) c.in += buf[i];
+        }
+    }
+}
+
+void server_t::flush(client_t& c) {
+    while (!c.out.empty()) {
+        ssize_t n = write(c.fd, c.out.data(), c.out.size());
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            drop(c.fd);
+            return;
+        }
+        c.out.erase(0, n);
+    }
+    bool want = !c.out.empty();
+    if (want != c.wantWrite) {                          // only wake up for writes while backed up
+        epoll_event ev;
+        ev.events = EPOLLIN | (want ? uint32_t(EPOLLOUT) : 0u);
+        ev.data.fd = c.fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+        c.wantWrite = want;
+    }
+}
+
+void server_t::drop(int fd) {
+    for (size_t i = 0; i < clients.size(); i++) {
+        if (clients[i].fd != fd) continue;
+        if (clients[i].pid >= 0) taken[clients[i].pid] = false;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        clients.erase(clients.begin() + i);
+        return;
+    }
+}
+
+/*
+ * function_identifier: one server tick - applies one queued key per client, advances the storm
+ *                      every STORM_TICKS, then sends only what changed
+ * parameters: none
+ * return value: none
+ */
+void server_t::tick() {
+    for (size_t i = 0; i < clients.size(); i++) {
+        client_t& c = clients[i];
+        if (c.in.empty()) continue;
+        int key = c.in[0];
+        c.in.erase(0, 1);
+        if (c.pid >= 0) game.command(c.pid, key);
+    }
+    bool finished = game.step();
+
+    string ents;
+    int entCount = 0;
+    for (int i = 0; i < PLAYERCNT; i++) {
+        if (p[0].playerStatus[i] == lastStatus[i]) continue;
+        lastStatus[i] = p[0].playerStatus[i];
+        ents += (char)i;
+        ents += (char)lastStatus[i];
+        entCount++;
+    }
+    map.takeChanges(cells);
+    if (!cells.empty() || entCount > 0) {               // quiet ticks cost nothing on the wire
+        string entBlock;
+        putVarint(entBlock, entCount);
+        entBlock += ents;
+        string frame = deltaFrame(cells, entBlock);
+        for (size_t i = 0; i < clients.size(); i++) clients[i].out += frame;
+    }
+
+    if (finished) {
+        string end;
+        end += (char)game.winner();
+        for (size_t i = 0; i < clients.size(); i++) putFrame(clients[i].out, MSG_END, end);
+        over = true;
+    }
+    for (size_t i = clients.size(); i-- > 0; ) {
+        if ((int)clients[i].out.size() > MAX_CLIENT_BACKLOG) drop(clients[i].fd);
+        else flush(clients[i]);
+    }
+}
+
+string server_t::fullFrame() {
+    const string* cached = joins.find(map.stateHash(), map.stateCheck());
+    if (cached != nullptr) return *cached;
+    string payload;
+    char run = map.glyphAt(0, 0);
+    unsigned int len = 0;
+    for (int y = 0; y < map.rows; y++) {
+        for (int x = 0; x < map.cols; x++) {
+            char g = map.glyphAt(x, y);
+            if (g != run) {
+                putVarint(payload, len);
+                payload += run;
+                run = g;
+                len = 0;
             }
-            if (foundPlayer) break;
+            len++;
         }
-    } else if (direction == 107 && haveLong ) {                           // right
-        bool foundObs = false;
-        bool foundPlayer = false;
-        
-        for (int i = p.pos.x; i <= GRIDX; i++) {             // CHECKING OBSTACLE
-            for (int j = 0; j < NUM_OF_OBSTACLES; j++){
-                if (map.egrid[p.pos.y][i] == (o+j)) {        // if there is an obstacle ANYWHERE above the player
-                    map.egrid[p.pos.y][i] = &e;
-                    foundObs = true;
-                    break;
-                }                                  // break out of double for loop
-                if (foundObs) break;
+    }
+    putVarint(payload, len);
+    payload += run;
+    string out;
+    putFrame(out, MSG_FULL, payload);
+    joins.put(map.stateHash(), map.stateCheck(), out);
+    return out;
+}
+
+// changed cells are sorted so the indices can be sent as small gaps
+string server_t::deltaFrame(const vector<int>& changedCells, const string& ents) {
+    vector<int> sorted(changedCells);
+    sort(sorted.begin(), sorted.end());
+    string payload;
+    putVarint(payload, game.tickNo);
+    putVarint(payload, sorted.size());
+    int prev = 0;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        putVarint(payload, sorted[i] - prev);
+        prev = sorted[i];
+        payload += map.glyphAt(sorted[i] % map.cols, sorted[i] / map.cols);
+    }
+    payload += ents;
+    unsigned long long hash = map.stateHash();           // the client checks its copy against this
+    for (int i = 0; i < 8; i++) payload += (char)(hash >> (8 * i));
+    string out;
+    putFrame(out, MSG_DELTA, payload);
+    return out;
+}
+
+/*
+ * function_identifier: sets up a fresh game and serves it until there's a winner
+ * parameters: address (port or unix socket path)
+ * return value: exit code
+ */
+int runServer(const char* addr) {
+    signal(SIGPIPE, SIG_IGN);
+    srand(time(NULL));
+    unique_ptr<match_t> game(new match_t(GRIDX, GRIDY, time(NULL)));
+    game->workers = std::max(1u, thread::hardware_concurrency());
+    server_t server(*game);
+    if (!server.open(addr)) {
+        cerr << "could not listen on " << addr << endl;
+        return 1;
+    }
+    cout << "serving " << GRIDX << "x" << GRIDY << " on " << addr << endl;
+    return server.run();
+}
+
+/*
+ * class_identifier: client side copy of the grid, rebuilt from the server's frames. it keeps the grid's
+ *                   zobrist hash the same way the server does and counts every delta whose hash
+ *                   disagrees, which means the copy has drifted from the server's grid
+ * constructors: netview_t()
+ * public functions:    int feed(string& buf)
+ *                      void print() const
+ * static members: none
+ */
+
+class netview_t {
+public:
+    netview_t() {pid = -1; cols = rows = 0; winner = -1; lastTick = 0; cellsApplied = 0; hash = 0; desyncs = 0;}
+    int feed(string& buf);              // applies every complete frame, returns how many
+    void print() const;
+    int pid;
+    int cols;
+    int rows;
+    int winner;                         // set once MSG_END arrives
+    unsigned int lastTick;
+    unsigned long cellsApplied;
+    unsigned long long hash;            // of grid, zobristKey() per cell
+    unsigned long desyncs;              // deltas whose hash didn't match ours
+    string grid;
+    bool alive[PLAYERCNT];
+};
+
+int netview_t::feed(string& buf) {
+    int frames = 0;
+    size_t at = 0;
+    for (;;) {
+        size_t start = at;
+        unsigned int len;
+        if (at >= buf.size()) break;
+        int type = (unsigned char)buf[at++];
+        if (!getVarint(buf, at, len) || buf.size() - at < len) {at = start; break;}
+        string payload = buf.substr(at, len);
+        at += len;
+        frames++;
+        size_t i = 0;
+        if (type == MSG_HELLO) {
+            unsigned int c, r;
+            i = 1;                          // the sizes follow the pid, a grid we couldn't index is ignored
+            if (len < 3 || !getVarint(payload, i, c) || !getVarint(payload, i, r) || (uint64_t)c * r > MAPFILE_MAX_CELLS)
+                continue;
+            pid = (unsigned char)payload[0] == 255 ? -1 : (unsigned char)payload[0];
+            cols = c;
+            rows = r;
+            grid.assign((size_t)cols * rows, ' ');
+            hash = 0;
+            for (int j = 0; j < PLAYERCNT; j++) alive[j] = ALIVE;
+        } else if (type == MSG_FULL) {
+            size_t cell = 0;
+            unsigned int run;
+            while (i < payload.size() && getVarint(payload, i, run) && i < payload.size()) {
+                char g = payload[i++];
+                for (unsigned int j = 0; j < run && cell < grid.size(); j++) grid[cell++] = g;
             }
-            if (foundObs) break;
-            for (int k = 0; k < PLAYERCNT; k++) {
-                if (map.egrid[p.pos.y][i+1] == (&p+k)) {
-                        (&p+k)->removePlayer();
-                        map.egrid[p.pos.y][i+1] = &e;
-                        foundPlayer = true;
-                        break;
+            hash = 0;
+            for (size_t j = 0; j < grid.size(); j++) hash ^= zobristKey(j, grid[j]);
+        } else if (type == MSG_DELTA) {
+            unsigned int n, gap, cell = 0;
+            getVarint(payload, i, lastTick);
+            getVarint(payload, i, n);
+            for (unsigned int j = 0; j < n && getVarint(payload, i, gap) && i < payload.size(); j++) {
+                cell += gap;
+                char g = payload[i++];
+                if (cell < grid.size()) {
+                    hash ^= zobristKey(cell, grid[cell]) ^ zobristKey(cell, g);
+                    grid[cell] = g;
                 }
-                if (foundPlayer) break;
+                cellsApplied++;
             }
-
-            if (foundPlayer) break;
-           
-        }
-        
-    } else if (direction == 104 && haveLong) {                              // left
-        bool foundObs = false;
-        bool foundPlayer = false;
-        for (int i = p.pos.x; i >= 0; i--) {                    // CHECKING OBSTACLE
-            for (int j = 0; j < NUM_OF_OBSTACLES; j++){
-                if (map.egrid[p.pos.y][i] == (o+j)) {           // if there is an obstacle ANYWHERE above the player
-                    map.egrid[p.pos.y][i] = &e;
-                    foundObs = true;
-                    break;
-                }   
-                if (foundObs) break;                               // break out of double for loop
+            getVarint(payload, i, n);
+            for (unsigned int j = 0; j < n && i + 2 <= payload.size(); j++) {
+                int who = (unsigned char)payload[i];
+                if (who < PLAYERCNT) alive[who] = payload[i + 1];
+                i += 2;
             }
-            if (foundObs) break;
-            for (int j = 0; j < PLAYERCNT; j++){
-                if (map.egrid[p.pos.y][i-1] == (&p+j)) {        // if there is an player ANYWHERE above the player
-                    (&p+j)->removePlayer();
-                    map.egrid[p.pos.y][i-1] = &e;
-                    foundPlayer = true;
-                    break;
-                }   
-                if (foundPlayer) break;                               // break out of double for loop
+            if (i + 8 <= payload.size()) {
+                unsigned long long theirs = 0;
+                for (int j = 0; j < 8; j++) theirs |= (unsigned long long)(unsigned char)payload[i + j] << (8 * j);
+                if (theirs != hash) desyncs++;
             }
-            if (foundPlayer) break;  
+        } else if (type == MSG_END && len >= 1) {
+            winner = (unsigned char)payload[0];
         }
-        
     }
-#endif
-}
-
-// ends curses lib and interface
-void endCurses() {
-#ifdef curses
-    refresh();
-    getch();    // asks for one final character
-    endwin();   // closes ncurses lib
-#endif
+    buf.erase(0, at);
+    return frames;
 }
 
-// initializes curses lib and prints out initial statements/instructions
-void initCurses() {
+void netview_t::print() const {
+    for (int y = 0; y < rows; y++) {
 #ifdef curses
-    initscr();
-    keypad(stdscr, TRUE); // accepts arrow keys
-    noecho();
-    raw(); //prevents exiting with commands
+        printw("%s\n", grid.substr(y * cols, cols).c_str());
+#else
+        cout << grid.substr(y * cols, cols) << endl;
 #endif
+    }
 }
 
 /*
- * function_identifier: checks when player steps on trigger
- * parameters: player obj, trigger obj
- * return value: true if player is on object, false otherwise
+ * function_identifier: connects to a server and plays. With a terminal on stdin it's an ncurses
+ *                      client, otherwise stdin is a script: one key is sent per tick and the final
+ *                      grid plus traffic stats are printed, so several clients can be scripted
+ *                      against one server from a shell
+ * parameters: address (port or unix socket path)
+ * return value: exit code
  */
+int runClient(const char* addr) {
+    signal(SIGPIPE, SIG_IGN);
+    int fd = openSocket(addr, false);
+    if (fd < 0) {
+        cerr << "could not connect to " << addr << endl;
+        return 1;
+    }
+    bool scripted = !isatty(0);
+    string script;
+    if (scripted) {
+        char c;
+        while (read(0, &c, 1) == 1) script += c;
+    } else {
+        initCurses();
+        timeout(0);
+    }
 
-bool winRnd(player_t p, trigger_t t) {
-    // looking to see if player steps on trigger
-    if ((p.pos.x == t.pos.x) && (p.pos.y == t.pos.y)) return true;
-    else return false;
+    netview_t view;
+    string in;
+    unsigned long bytes = 0;
+    size_t sent = 0;
+    int idleTicks = 0;
+    bool done = false;
+    while (!done) {
+        pollfd pfd[2];
+        pfd[0].fd = fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = 0;
+        pfd[1].events = POLLIN;
+        int n = poll(pfd, scripted ? 1 : 2, TICK_MS);
+        if (n < 0 && errno == EINTR) continue;
+
+        if (pfd[0].revents & (POLLIN | POLLHUP)) {
+            char buf[4096];
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if (r <= 0) done = true;
+            else {
+                bytes += r;
+                in.append(buf, r);
+                view.feed(in);
+                if (view.winner >= 0) done = true;
+            }
+        }
+        if (scripted) {
+            if (n == 0) {                               // one scripted key per idle tick
+                if (sent < script.size()) {
+                    char key = script[sent++];
+                    if (key != '\n' && write(fd, &key, 1) < 0) done = true;
+                } else if (++idleTicks > 5) {
+                    done = true;                        // let the last moves come back first
+                }
+            }
+        } else {
+            int key = getch();
+            if (key == 'q') done = true;
+            if (key != ERR) {
+                char k = key;
+                if (write(fd, &k, 1) < 0) done = true;
+            }
+            clear();
+            printw("Victor's Battle Royale! - you are '%c', tick %u\n", view.pid < 0 ? '?' : view.pid + INT_TO_UPPER_ALPH, view.lastTick);
+            view.print();
+            if (view.pid >= 0 && view.alive[view.pid] == DEAD) printw("You died, spectating\n");
+            refresh();
+        }
+    }
+    close(fd);
+
+    if (scripted) {
+        for (int y = 0; y < view.rows; y++) cout << view.grid.substr(y * view.cols, view.cols) << endl;
+        cout << "pid " << view.pid << " tick " << view.lastTick << " bytes " << bytes
+             << " cells " << view.cellsApplied << " desyncs " << view.desyncs << endl;
+        if (view.winner >= 0) cout << "winner " << (char)(view.winner + INT_TO_UPPER_ALPH) << endl;
+    } else {
+        if (view.winner >= 0) printw("Player '%c' wins!\n", view.winner + INT_TO_UPPER_ALPH);
+        endCurses();
+    }
+    return 0;
 }
 
+// ------------------------------- MATCH HOSTING -------------------------------
+
+const char BOT_KEYS[] = "wasdfuhjkr";   // hosted matches have no humans, every player mashes these
+
+// counts every hosted event by kind, on the bus's dispatcher thread
+class eventtally_t : public subscriber_t {
+public:
+    eventtally_t() {for (int i = 0; i < EVENT_KINDS; i++) counts[i] = 0;}
+    void onEvent(const gameevent_t& ev) {counts[ev.kind]++;}
+    unsigned long counts[EVENT_KINDS];
+};
+
 /*
- * function_identifier: counts and returns number of players alive
- * parameters: player_t *p
- * return value: number alive
+ * class_identifier: hosts many independent matches in one process on a pool of worker threads
+ *                   each worker keeps a heap of its matches ordered by tick deadline and always runs
+ *                   the most urgent due one; a worker with nothing due steals the most urgent due match
+ *                   from the others. start jitter and missed deadlines are kept per match
+ * constructors: host_t(int matches, int threads, int cols, int rows)
+ * public functions:    void run(int seconds)
+ *                      void report() const
+ * static members: none
  */
 
-int numAlive(player_t *p) {
-    int alive = 0;
-    for (int i = 0; i < PLAYERCNT; i++) {
-        if (p[0].playerStatus[i] == ALIVE)
-            alive++;
+class host_t {
+public:
+    host_t(int matches, int threads, int cols, int rows, statsink_t* sink = nullptr);
+    void run(int seconds);
+    void report() const;
+private:
+    struct slot_t {
+        unique_ptr<match_t> game;
+        unique_ptr<statlog_t> log;      // game's analytics, only with a sink
+        unsigned int seed;              // next match in this slot gets seed + 1
+        long long release;              // ns since start when the next tick may begin
+        unsigned long ticks;
+        unsigned long missed;           // ticks that finished after release + period
+        unsigned long games;            // matches finished (and restarted) in this slot
+        long long jitterSum;            // ns between release and actually starting
+        long long jitterMax;
+    };
+    struct queue_t {
+        mutex lock;
+        vector<pair<long long, int> > heap;     // (release, slot), earliest on top
+    };
+    long long now() const;
+    bool popDue(int w, long long t, int& slot);
+    long long peek(int w);
+    void push(int w, int slot);
+    void worker(int w);
+    void tickSlot(int slot);
+    void newMatch(slot_t& s);
+    vector<slot_t> slots;
+    statsink_t* sink;
+    eventbus_t events;                  // every match publishes here
+    eventtally_t tally;
+    vector<unique_ptr<queue_t> > queues;
+    int cols;
+    int rows;
+    long long period;
+    atomic<bool> stop;
+    atomic<unsigned long> steals;
+    chrono::steady_clock::time_point start;
+    double elapsed;
+};
+
+host_t::host_t(int matches, int threads, int c, int r, statsink_t* statSink)
+    : slots(matches), events(EVENT_QUEUE), stop(false), steals(0) {
+    sink = statSink;
+    events.subscribe(&tally);
+    cols = c;
+    rows = r;
+    period = TICK_MS * 1000000LL;
+    elapsed = 0;
+    for (int i = 0; i < threads; i++) queues.push_back(unique_ptr<queue_t>(new queue_t));
+    for (int i = 0; i < matches; i++) {
+        slot_t& s = slots[i];
+        s.seed = time(NULL) + i * 7919;
+        newMatch(s);
+        s.release = period * i / matches;       // spread the ticks over the period
+        s.ticks = s.missed = s.games = 0;
+        s.jitterSum = s.jitterMax = 0;
+        push(i % threads, i);
+    }
+}
+
+long long host_t::now() const {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+void host_t::push(int w, int slot) {
+    lock_guard<mutex> guard(queues[w]->lock);
+    vector<pair<long long, int> >& heap = queues[w]->heap;
+    heap.push_back(make_pair(slots[slot].release, slot));
+    push_heap(heap.begin(), heap.end(), greater<pair<long long, int> >());
+}
+
+// release time of the most urgent match in a queue, -1 when empty
+long long host_t::peek(int w) {
+    lock_guard<mutex> guard(queues[w]->lock);
+    return queues[w]->heap.empty() ? -1 : queues[w]->heap.front().first;
+}
+
+bool host_t::popDue(int w, long long t, int& slot) {
+    lock_guard<mutex> guard(queues[w]->lock);
+    vector<pair<long long, int> >& heap = queues[w]->heap;
+    if (heap.empty() || heap.front().first > t) return false;
+    pop_heap(heap.begin(), heap.end(), greater<pair<long long, int> >());
+    slot = heap.back().second;
+    heap.pop_back();
+    return true;
+}
+
+void host_t::worker(int w) {
+    int n = queues.size();
+    while (!stop) {
+        long long t = now();
+        int slot;
+        bool got = popDue(w, t, slot);
+        if (!got) {                                     // steal the most urgent due match elsewhere
+            int victim = -1;
+            long long best = t + 1;
+            for (int k = 1; k < n; k++) {
+                long long r = peek((w + k) % n);
+                if (r >= 0 && r < best) {best = r; victim = (w + k) % n;}
+            }
+            if (victim >= 0 && popDue(victim, t, slot)) {
+                got = true;
+                steals++;
+            }
+        }
+        if (got) {
+            tickSlot(slot);
+            push(w, slot);                              // the match now lives with whoever ran it
+            continue;
+        }
+        long long next = peek(w);
+        long long wait = (next < 0 || next - t > 500000) ? 500000 : next - t;
+        this_thread::sleep_for(chrono::nanoseconds(wait));
     }
-    return alive;
 }
 
 /*
- * function_identifier: searches and returns the id of last player alive
- * parameters: player_t *p
- * return value: player id
+ * function_identifier: runs one tick of one match with bots pressing random keys, keeps its timing stats
+ *                      and restarts the match in place once it's over
+ * parameters: slot index
+ * return value: none
  */
+void host_t::tickSlot(int slot) {
+    slot_t& s = slots[slot];
+    long long began = now();
+    long long jitter = began - s.release;
+    s.jitterSum += jitter;
+    if (jitter > s.jitterMax) s.jitterMax = jitter;
+    s.ticks++;
 
-int whoAlive(player_t *p) {
-    int pid;
-    for (int i = 0; i < PLAYERCNT; i++) {
-    if (p[0].playerStatus[i] == ALIVE)
-        pid = i;
+    match_t& game = *s.game;
+#ifndef __cpp_impl_coroutine
+    for (int i = 0; i < PLAYERCNT; i++) {              // bots head for the safe zone half the time
+        int x = game.p[i].pos().x, y = game.p[i].pos().y;   // unless they're in someone's firing line
+        int key = rand_r(&game.rng) % 2 && game.threat.lines(x, y) == 0 ? game.flow.nextKey(x, y) : 0;
+        if (key == 0) key = BOT_KEYS[rand_r(&game.rng) % (sizeof(BOT_KEYS) - 1)];
+        game.command(i, key);
     }
-    return pid;
+#endif
+    bool finished = game.step();        // with coroutines the players' scripts run in here
+
+    long long done = now();
+    if (done > s.release + period) s.missed++;
+    s.release += period;
+    if (done > s.release + period) {                   // more than a whole tick behind, skip ahead
+        long long behind = (done - s.release) / period;
+        s.missed += behind;
+        s.release += behind * period;
+    }
+    if (finished) {
+        s.games++;
+        if (s.log) s.log->flush(true);
+        s.seed++;
+        newMatch(s);
+    }
+}
+
+// with coroutine support every hosted player runs an NPC script, otherwise tickSlot() drives them
+void host_t::newMatch(slot_t& s) {
+    match_t* game = new match_t(cols, rows, s.seed);
+#ifdef __cpp_impl_coroutine
+    game->scriptPlayers(0, PLAYERCNT);
+#endif
+    if (sink != nullptr) {
+        s.log.reset(new statlog_t(*sink, cols, rows));
+        game->stats = s.log.get();
+    }
+    game->events = &events;
+    game->eventId = &s - &slots[0];
+    s.game.reset(game);
+}
+
+void host_t::run(int seconds) {
+    start = chrono::steady_clock::now();
+    events.start();
+    vector<thread> pool;
+    for (size_t i = 0; i < queues.size(); i++) pool.push_back(thread(&host_t::worker, this, (int)i));
+    this_thread::sleep_for(chrono::seconds(seconds));
+    stop = true;
+    for (size_t i = 0; i < pool.size(); i++) pool[i].join();
+    events.stop();
+    elapsed = now() / 1e9;
+    for (size_t i = 0; i < slots.size(); i++) if (slots[i].log) slots[i].log->flush(false);   // matches still running
+}
+
+void host_t::report() const {
+    unsigned long ticks = 0, missed = 0, games = 0;
+    long long jitterSum = 0, jitterMax = 0;
+    for (size_t i = 0; i < slots.size(); i++) {
+        const slot_t& s = slots[i];
+        cout << "match " << i << ": " << s.ticks << " ticks, " << s.games << " games, jitter avg "
+             << (s.ticks ? s.jitterSum / (double)s.ticks / 1e6 : 0) << " ms max " << s.jitterMax / 1e6
+             << " ms, " << s.missed << " missed" << endl;
+        ticks += s.ticks;
+        missed += s.missed;
+        games += s.games;
+        jitterSum += s.jitterSum;
+        if (s.jitterMax > jitterMax) jitterMax = s.jitterMax;
+    }
+    cout << slots.size() << " matches on " << queues.size() << " threads for " << elapsed << " s: "
+         << ticks << " ticks (" << ticks / elapsed << "/s), " << games << " games, jitter avg "
+         << (ticks ? jitterSum / (double)ticks / 1e6 : 0) << " ms max " << jitterMax / 1e6 << " ms, "
+         << missed << " missed deadlines, " << steals.load() << " steals" << endl;
+    cout << "events: " << tally.counts[EVENT_KILL] << " kills, " << tally.counts[EVENT_DAMAGE] << " hits, "
+         << tally.counts[EVENT_PICKUP] << " pickups, " << tally.counts[EVENT_STORM] << " storm steps, "
+         << tally.counts[EVENT_VICTORY] << " wins, " << events.dropped() << " dropped" << endl;
 }
 
+// ------------------------------- TRAINING API -------------------------------
+// N independent matches stepped in lockstep for bots learning the game. every player of every match
+// is an agent. observations, rewards and done flags live in buffers the environment owns and
+// rewrites in place, so callers read them through the pointers without copying.
+// a match that ends is restarted straight away (its done flag says so) and the buffers already
+// show the first state of the new one
+
+const char ENV_ACTIONS[] = " wasdfuhjkr";                   // action i presses ENV_ACTIONS[i], 0 does nothing
+const int ENV_ACTION_COUNT = sizeof(ENV_ACTIONS) - 1;
+const int ENV_CH_OBSTACLE = 0;      // grid channels: 1 for '@' and authored walls
+const int ENV_CH_PLAYER = 1;        // pid + 1
+const int ENV_CH_WEAPON = 2;        // 1 for '#', 2 for '!'
+const int ENV_CH_STORM = 3;         // 1 inside the storm
+const int ENV_CHANNELS = 4;
+const int ENV_SCALARS = 9;          // per agent: x, y, alive, hp, has '#', has '!', cooling down,
+                                    // rounds in the '!' magazine, steps to the storm edge
+
 /*
- * function_identifier: checks if winner exists, and decides who it is
- * parameters: player_t *p, map_t m, int lastAlive
- * return value: true if there is a winner, false if no winner yet
+ * class_identifier: the vectorized environment. the layouts are
+ *                   grid     uint8  [envs][ENV_CHANNELS][rows][cols]
+ *                   scalars  float  [envs][PLAYERCNT][ENV_SCALARS]
+ *                   rewards  float  [envs][PLAYERCNT]   -1 the step an agent dies, +1 for the winner
+ *                   dones    uint8  [envs]
+ *                   hashes   uint64 [envs]   the grid's zobrist hash, for telling runs that diverged apart
+ *                   actions  int32  [envs][PLAYERCNT]   indices into ENV_ACTIONS
+ *                   step() splits the matches over a pool of threads kept for the environment's lifetime,
+ *                   the calling thread takes the first share
+ * constructors: vecenv_t(int envs, int threads, int cols, int rows)
+ * public functions:    void reset(unsigned int seed)
+ *                      void step(const int32_t* actions)
+ *                      int count() const
+ *                      uint8_t* grid()
+ *                      float* scalars()
+ *                      float* rewards()
+ *                      uint8_t* dones()
+ *                      uint64_t* hashes()
+ * static members: none
  */
 
-bool checkVictor(player_t *p, map_t m, int lastAlive) {
-    if (numAlive(p)==1) {
-        printw("Victory Royale!\n");
-        printw("Player '%c' wins!\n", whoAlive(p)+INT_TO_UPPER_ALPH);
-        printw("Game Over!\n");
-        return true;
-    } else if (numAlive(p) == 0) {
-        printw("Victory Royale!\n");
-        printw("player '%c' nearly took the L, but won!\n", lastAlive+INT_TO_UPPER_ALPH);
-        printw("Game Over!\n");
-        return true;
+class vecenv_t {
+public:
+    vecenv_t(int envs, int threads, int cols, int rows);
+    ~vecenv_t();
+    vecenv_t(const vecenv_t&) = delete;
+    vecenv_t& operator=(const vecenv_t&) = delete;
+    void reset(unsigned int seed);      // env i starts from seed + i
+    void step(const int32_t* actions);
+    int count() const {return games.size();}
+    uint8_t* grid() {return gridObs.data();}
+    float* scalars() {return scalarObs.data();}
+    float* rewards() {return reward.data();}
+    uint8_t* dones() {return done.data();}
+    uint64_t* hashes() {return hash.data();}
+private:
+    void stepRange(int first, int last);
+    void restart(int env);
+    void observe(int env);
+    void worker(int w);
+    vector<unique_ptr<match_t> > games;
+    vector<unsigned int> seeds;
+    vector<uint8_t> gridObs;
+    vector<float> scalarObs;
+    vector<float> reward;
+    vector<uint8_t> done;
+    vector<uint64_t> hash;
+    int cols;
+    int rows;
+    int threads;                        // pool threads plus the caller
+    vector<thread> pool;
+    mutex lock;
+    condition_variable wake;            // a new step for the pool
+    condition_variable finished;        // the pool's shares are done
+    unsigned long generation;
+    int busy;                           // pool threads still on this step
+    bool quitting;
+    const int32_t* actions;             // this step's, read by every thread
+};
+
+vecenv_t::vecenv_t(int envs, int threads, int c, int r) : games(envs), seeds(envs, 0), hash(envs, 0) {
+    cols = c;
+    rows = r;
+    gridObs.assign((size_t)envs * ENV_CHANNELS * rows * cols, 0);
+    scalarObs.assign((size_t)envs * PLAYERCNT * ENV_SCALARS, 0);
+    reward.assign((size_t)envs * PLAYERCNT, 0);
+    done.assign(envs, 0);
+    generation = 0;
+    busy = 0;
+    quitting = false;
+    actions = nullptr;
+    this->threads = std::max(1, std::min(threads, envs));
+    for (int w = 1; w < this->threads; w++) pool.push_back(thread(&vecenv_t::worker, this, w));
+    reset(time(NULL));
+}
+
+vecenv_t::~vecenv_t() {
+    {
+        lock_guard<mutex> hold(lock);
+        quitting = true;
     }
-    return false;
+    wake.notify_all();
+    for (size_t i = 0; i < pool.size(); i++) pool[i].join();
 }
 
-// returns whether or not the current cell contains a player
-// used for determining what the storm destroys
-bool isPlayer(ent_t*** egrid, player_t*p, int x, int y){
-    for (int i = 0; i < PLAYERCNT; i++){
-        if (egrid[y][x] == (p+i)) return true;
+void vecenv_t::reset(unsigned int seed) {
+    for (size_t i = 0; i < games.size(); i++) {
+        seeds[i] = seed + i;
+        restart(i);
+        done[i] = 0;
+    }
+    fill(reward.begin(), reward.end(), 0.0f);
+}
+
+// the env's next match, seeds[env] moves on by the number of envs so no two matches share one
+void vecenv_t::restart(int env) {
+    games[env].reset(new match_t(cols, rows, seeds[env]));
+    games[env]->blind();                // observations show the whole grid, fog is for people
+    seeds[env] += games.size();
+    observe(env);
+}
+
+void vecenv_t::step(const int32_t* stepActions) {
+    {
+        lock_guard<mutex> hold(lock);
+        actions = stepActions;
+        busy = threads - 1;
+        generation++;
+    }
+    wake.notify_all();
+    stepRange(0, games.size() / threads);
+    unique_lock<mutex> hold(lock);
+    finished.wait(hold, [this] {return busy == 0;});
+}
+
+void vecenv_t::worker(int w) {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> hold(lock);
+            wake.wait(hold, [&] {return quitting || generation != seen;});
+            if (quitting) return;
+            seen = generation;
+        }
+        stepRange(games.size() * w / threads, games.size() * (w + 1) / threads);
+        lock_guard<mutex> hold(lock);
+        if (--busy == 0) finished.notify_one();
     }
-    return false;
 }
 
 /*
- * function_identifier: advances the storm posiiton on the map
- * parameters: map_t &m, ent_t*e, player_t*p, int& pU, int& pR, int& pD, int& pL
+ * function_identifier: one tick of matches first..last-1: every agent's action, the tick, rewards and
+ *                      the new observation, restarting matches that ended
+ * parameters: range of envs
  * return value: none
  */
-void update(map_t &m, ent_t*e, player_t*p, int& pU, int& pR, int& pD, int& pL) {
-    int performedUp = 0; int performedDown = 0; int performedRight = 0; int performedLeft = 0;
-    
-    if(m.dXR == m.radius) {                                     // remove right
-        pR++;
-        for (int i = 0; i < m.rows; i++) {
-            if (pR > 2) {
-                m.egrid[i][m.centerCoord.x + m.dXR+2] = e;              // perform the second round of the storm, to damage the chars that weren't initially
-            }
-            if (isPlayer(m.egrid, p,  m.centerCoord.x + m.dXR, i)) {   // if there is a player
-                    continue;                                           
-            } else {
-                m.egrid[i][m.centerCoord.x + m.dXR] = e;               // destroy it
-            } 
+void vecenv_t::stepRange(int first, int last) {
+    for (int i = first; i < last; i++) {
+        match_t& game = *games[i];
+        const int32_t* act = actions + (size_t)i * PLAYERCNT;
+        float* r = &reward[(size_t)i * PLAYERCNT];
+        bool before[PLAYERCNT];
+        copy(game.playerStatus, game.playerStatus + PLAYERCNT, before);
+        for (int pid = 0; pid < PLAYERCNT; pid++)
+            if (act[pid] > 0 && act[pid] < ENV_ACTION_COUNT) game.command(pid, ENV_ACTIONS[act[pid]]);
+        bool over = game.step();
+        for (int pid = 0; pid < PLAYERCNT; pid++)
+            r[pid] = before[pid] == ALIVE && game.playerStatus[pid] == DEAD ? -1.0f : 0.0f;
+        done[i] = over;
+        if (over) {
+            int win = game.winner();
+            if (win >= 0 && win < PLAYERCNT) r[win] += 1.0f;
+            restart(i);
+        } else {
+            observe(i);
         }
-        m.dXR -= 1;
     }
-    if (m.dXL == m.radius) {                                    // remove left
-        pL++;
-        for (int i = 0; i < m.rows; i++) {
-            if (pL>2) {
-                m.egrid[i][m.centerCoord.x - (2+m.dXL)] = e;  
-            }
-            if (isPlayer(m.egrid, p,  m.centerCoord.x - m.dXL, i)) {
+}
+
+// writes env's slice of the grid and scalar buffers from its match
+void vecenv_t::observe(int env) {
+    match_t& game = *games[env];
+    uint8_t* g = &gridObs[(size_t)env * ENV_CHANNELS * rows * cols];
+    memset(g, 0, (size_t)ENV_CHANNELS * rows * cols);
+    size_t plane = (size_t)rows * cols;
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < cols; x++) {
+            ent_t* cell = game.map.egrid[y][x];
+            if (cell == nullptr || cell->getWorld() != &game.world) {
+                if (cell == &game.map) g[ENV_CH_STORM * plane + y * cols + x] = 1;
                 continue;
             }
-            else {
-             m.egrid[i][m.centerCoord.x - m.dXL] = e;
-            }
+            size_t at = (size_t)y * cols + x;
+            int arch = cell->getArch();
+            if (arch == ARCH_OBSTACLE || arch == ARCH_WALL) g[ENV_CH_OBSTACLE * plane + at] = 1;
+            else if (arch == ARCH_PLAYER) g[ENV_CH_PLAYER * plane + at] = cell->getRow() + 1;
+            else if (arch == ARCH_PICKUP) g[ENV_CH_WEAPON * plane + at] = cell->glyph() == '!' ? 2 : 1;
         }
-        m.dXL -= 1;
     }
-    if (m.dYU == m.radius) {                                    // remove up
-        pU++;
-        for (int i = 0; i < m.cols; i++) {
-            if (pU>2) {
-                   m.egrid[m.centerCoord.y - (m.dYU+2)][i] = e;  
-            }
-            if (isPlayer(m.egrid, p,  i, m.centerCoord.y - m.dYU)){
-                continue;
-            } else {
-                m.egrid[m.centerCoord.y - m.dYU][i] = e;
-         
-            }
+
+    hash[env] = game.map.stateHash();
+
+    float* s = &scalarObs[(size_t)env * PLAYERCNT * ENV_SCALARS];
+    const coord_t* pos = game.world.pos(ARCH_PLAYER);
+    const health_t* hp = game.world.hp(ARCH_PLAYER);
+    const inventory_t* inv = game.world.inventories(ARCH_PLAYER);
+    for (int pid = 0; pid < PLAYERCNT; pid++, s += ENV_SCALARS) {
+        s[0] = pos[pid].x;
+        s[1] = pos[pid].y;
+        s[2] = game.playerStatus[pid] == ALIVE;
+        s[3] = hp[pid].gethp();
+        s[4] = inv[pid].has(SLOT_SHORT);
+        s[5] = inv[pid].has(SLOT_LONG);
+        s[6] = game.coolingDown[pid];
+        s[7] = inv[pid].has(SLOT_LONG) ? inv[pid].get(SLOT_LONG).getMagAmmo() : 0;
+        s[8] = game.threat.stormDistance(pos[pid].x, pos[pid].y);
+    }
+}
+
+// the same environment for C callers (and anything that loads the game built with -DGAME_LIBRARY)
+extern "C" {
+vecenv_t* envCreate(int envs, int threads, int cols, int rows) {return new vecenv_t(envs, threads, cols, rows);}
+void envDestroy(vecenv_t* env) {delete env;}
+void envReset(vecenv_t* env, unsigned int seed) {env->reset(seed);}
+void envStep(vecenv_t* env, const int32_t* actions) {env->step(actions);}
+uint8_t* envGrid(vecenv_t* env) {return env->grid();}
+float* envScalars(vecenv_t* env) {return env->scalars();}
+float* envRewards(vecenv_t* env) {return env->rewards();}
+uint8_t* envDones(vecenv_t* env) {return env->dones();}
+uint64_t* envHashes(vecenv_t* env) {return env->hashes();}
+}
+
+/*
+ * function_identifier: steps an environment with random actions and prints its throughput
+ * parameters: matches, threads, steps per match, grid size
+ * return value: exit code
+ */
+int benchEnv(int envs, int threads, int steps, int cols, int rows) {
+    if (envs < 1 || threads < 1 || steps < 1) {
+        cerr << "--env needs at least one match, one thread and one step" << endl;
+        return 1;
+    }
+    vecenv_t env(envs, threads, cols, rows);
+    vector<int32_t> actions((size_t)envs * PLAYERCNT);
+    unsigned int seed = 1;
+    unsigned long games = 0;
+    double rewardSum = 0;
+    chrono::steady_clock::time_point began = chrono::steady_clock::now();
+    for (int t = 0; t < steps; t++) {
+        for (size_t i = 0; i < actions.size(); i++) actions[i] = rand_r(&seed) % ENV_ACTION_COUNT;
+        env.step(actions.data());
+        for (int i = 0; i < envs; i++) games += env.dones()[i];
+        for (size_t i = 0; i < actions.size(); i++) rewardSum += env.rewards()[i];
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - began).count();
+    cout << envs << " matches on " << threads << " threads, " << steps << " steps each in " << secs << " s: "
+         << envs * (double)steps / secs << " env steps/s, " << games << " games, reward sum " << rewardSum << endl;
+    return 0;
+}
+
+/*
+ * class_identifier: lock-free single producer / single consumer ring of keypresses
+ *                   the input thread pushes, the game loop pops at its tick boundaries. head and tail
+ *                   only ever grow (wrapping unsigned), each is written by one side only, so a full
+ *                   ring makes the producer wait rather than drop or overwrite a key
+ * constructors: inputring_t()
+ * public functions:    void push(const keypress_t& k)
+ *                      bool pop(keypress_t& k)
+ *                      int fill() const
+ *                      int highWater() const
+ * static members: CAPACITY
+ */
+
+struct keypress_t {
+    int key;
+    long long at;               // steady_clock nanoseconds when the input thread read it
+};
+
+class inputring_t {
+public:
+    inputring_t() : head(0), tail(0), peak(0) {}
+    void push(const keypress_t& k);     // producer only
+    bool pop(keypress_t& k);            // consumer only, false if nothing is waiting
+    int fill() const {return tail.load(memory_order_acquire) - head.load(memory_order_acquire);}
+    int highWater() const {return peak.load(memory_order_relaxed);}     // most keys ever waiting at once
+    static const unsigned int CAPACITY = 1024;  // power of two
+private:
+    keypress_t slots[CAPACITY];
+    alignas(64) atomic<unsigned int> head;      // next slot to pop
+    alignas(64) atomic<unsigned int> tail;      // next slot to push
+    atomic<int> peak;
+};
+
+void inputring_t::push(const keypress_t& k) {
+    unsigned int t = tail.load(memory_order_relaxed);
+    while (t - head.load(memory_order_acquire) == CAPACITY) this_thread::yield();    // full, never drop
+    slots[t & (CAPACITY - 1)] = k;
+    tail.store(t + 1, memory_order_release);
+    int waiting = t + 1 - head.load(memory_order_relaxed);
+    if (waiting > peak.load(memory_order_relaxed)) peak.store(waiting, memory_order_relaxed);
+}
+
+bool inputring_t::pop(keypress_t& k) {
+    unsigned int h = head.load(memory_order_relaxed);
+    if (h == tail.load(memory_order_acquire)) return false;
+    k = slots[h & (CAPACITY - 1)];
+    head.store(h + 1, memory_order_release);
+    return true;
+}
+
+/*
+ * function_identifier: input thread - reads the terminal (already raw from initCurses) straight off the
+ *                      file descriptor so it never touches curses, and timestamps every byte into the ring
+ *                      end of input counts as 'q'
+ * parameters: descriptor to read, ring to fill, set by the game loop when it's done
+ * return value: none
+ */
+void readInput(int fd, inputring_t& ring, atomic<bool>& stop) {
+    char buf[64];
+    while (!stop.load()) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 50) <= 0) continue;           // wakes up now and then to look at stop
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        long long at = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        if (n <= 0) {
+            ring.push(keypress_t{'q', at});
+            return;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            int key = (unsigned char)buf[i];
+            if (key == '\r') key = '\n';                // what curses' nl() used to do for us
+            ring.push(keypress_t{key, at});
         }
-        m.dYU -= 1;
     }
-    if (m.dYB == m.radius) {                                    // remove down
-    pD++;
-        for (int i = 0; i < m.cols; i++) {
-            if (pD>2) {
-                m.egrid[2+ m.centerCoord.y + m.dYB][i] = e;  
-            }
-            if (isPlayer(m.egrid, p,  i, m.centerCoord.y + m.dYB)) {
-                continue;
-            } else {
-                m.egrid[m.centerCoord.y + m.dYB][i] = e;
-         
+}
+
+/*
+ * class_identifier: triple buffer of finished frames between the game loop and the render thread
+ *                   the game fills its back slot and swaps it into the middle, the renderer swaps the
+ *                   middle into its front slot only if something new landed there. neither side ever
+ *                   waits for the other, and frames the renderer was too slow for are simply replaced
+ * constructors: framebuffer_t()
+ * public functions:    frame_t& back()
+ *                      void publish()
+ *                      bool acquire()
+ *                      const frame_t& front() const
+ * static members: none
+ */
+
+struct frame_t {
+    string top;                 // lines above the grid
+    int cols;
+    int rows;
+    vector<char> cells;         // map_t::snapshot() of the camera's window
+    int miniCols;               // 0 while the whole map fits on screen
+    vector<char> mini;          // minimap_t::draw(), padded to rows
+    string bottom;              // lines below it
+};
+
+class framebuffer_t {
+public:
+    framebuffer_t() : middle(1) {backSlot = 0; frontSlot = 2;}
+    frame_t& back() {return slots[backSlot];}           // game loop only
+    void publish() {backSlot = middle.exchange(backSlot | FRESH) & ~FRESH;}
+    bool acquire();                                     // render thread only, true if front() changed
+    const frame_t& front() const {return slots[frontSlot];}
+private:
+    static const int FRESH = 4;     // set in middle while it holds a frame the renderer hasn't taken
+    frame_t slots[3];
+    atomic<int> middle;
+    int backSlot;
+    int frontSlot;
+};
+
+bool framebuffer_t::acquire() {
+    if (!(middle.load(memory_order_acquire) & FRESH)) return false;
+    frontSlot = middle.exchange(frontSlot) & ~FRESH;
+    return true;
+}
+
+/*
+ * function_identifier: render thread - the only thing that talks to curses while the game runs
+ *                      draws the newest published frame, skipping any it didn't get to in time
+ * parameters: the frames, set by the game loop once the last frame is published
+ * return value: none
+ */
+void renderFrames(framebuffer_t& frames, atomic<bool>& stop) {
+    while (true) {
+        bool done = stop.load();        // read first, so the last frame published before stop is drawn
+        if (frames.acquire()) {
+            const frame_t& f = frames.front();
+            erase();
+            addstr(f.top.c_str());
+            for (int i = 0; i < f.rows; i++) {
+                addnstr(&f.cells[i * f.cols], f.cols);
+                if (f.miniCols > 0) {
+                    addstr(" | ");
+                    addnstr(&f.mini[i * f.miniCols], f.miniCols);
+                }
+                addch('\n');
             }
+            addstr(f.bottom.c_str());
+            refresh();
+        } else if (done) {
+            return;
+        } else {
+            this_thread::sleep_for(chrono::milliseconds(RENDER_POLL_MS));
         }
-        m.dYB -= 1;
     }
-    m.radius -= 1;
 }
 
+const int VIEW_TEXT_LINES = 9;      // terminal lines the local game keeps for text above and below the grid
+
+// the local game's one line of news, written by the bus's dispatcher and read when a frame is built
+class killfeed_t : public subscriber_t {
+public:
+    void onEvent(const gameevent_t& ev);
+    string latest();
+private:
+    mutex lock;
+    string line;
+};
+
+void killfeed_t::onEvent(const gameevent_t& ev) {
+    char who = ev.pid + INT_TO_UPPER_ALPH;
+    char buf[64];
+    if (ev.kind == EVENT_KILL)
+        snprintf(buf, sizeof(buf), "'%c' %s\n", who, ev.value == STAT_STORM_DEATH ? "was taken by the storm" :
+                 ev.value == STAT_LONG_DEATH ? "was shot from afar" : "lost a fight");
+    else if (ev.kind == EVENT_PICKUP)
+        snprintf(buf, sizeof(buf), "'%c' picked up a '%c'\n", who, ev.value == SLOT_LONG ? '!' : '#');
+    else if (ev.kind == EVENT_STORM)
+        snprintf(buf, sizeof(buf), "The storm closes in, radius %i\n", ev.value);
+    else return;
+    lock_guard<mutex> hold(lock);
+    line = buf;
+}
+
+string killfeed_t::latest() {
+    lock_guard<mutex> hold(lock);
+    return line;
+}
+
+// what the local game does with a key, every key is looked up here once
+const int KEY_IGNORED = 0;
+const int KEY_PLAY = 1;             // move, attack or reload - handed to match_t::command()
+const int KEY_ROUND = 2;            // enter, advances the storm
+const int KEY_QUIT = 3;
+const int KEY_REWIND = 4;           // b, undoes the last tick
+
+struct keyactions_t {
+    unsigned char action[256];
+    keyactions_t() {
+        memset(action, KEY_IGNORED, sizeof(action));
+        const char* play = "wasdfuhjkr";
+        for (int i = 0; play[i] != '\0'; i++) action[(int)play[i]] = KEY_PLAY;
+        action['\n'] = KEY_ROUND;
+        action['q'] = KEY_QUIT;
+        action['b'] = KEY_REWIND;
+    }
+    int operator[](int key) const {return key >= 0 && key < 256 ? action[key] : KEY_IGNORED;}   // curses keys are above 255
+};
+const keyactions_t KEY_ACTIONS;
+
+#ifndef GAME_LIBRARY   // -DGAME_LIBRARY -shared -fPIC leaves main out, for loading the env* functions
 /*
  * function_identifier: "client code" where objects are created and added to the game
  *                       there is also a section to test methods of all the classes
@@ -1334,103 +5540,214 @@ void update(map_t &m, ent_t*e, player_t*p, int& pU, int& pR, int& pD, int& pL) {
  */
 
 int main(int argc, char* argv[]) {
+    // multiplayer modes: --server <port|socket path> [x y], --client <port|socket path>
+    if (argc >= 3 && string(argv[1]) == "--server") {
+        if (argc == 5) {
+            GRIDX = atoi(argv[3]);
+            GRIDY = atoi(argv[4]);
+        }
+        return runServer(argv[2]);
+    }
+    if (argc == 3 && string(argv[1]) == "--client") return runClient(argv[2]);
+    // hosting mode: --host <matches> <threads> <seconds> [x y] [--stats <file>]
+    if (argc >= 5 && string(argv[1]) == "--host") {
+        statsink_t sink;
+        bool logging = argc >= 7 && string(argv[argc - 2]) == "--stats";
+        if (logging && !sink.open(argv[argc - 1])) {
+            cerr << "could not write " << argv[argc - 1] << endl;
+            return 1;
+        }
+        if (argc - (logging ? 2 : 0) == 7) {
+            GRIDX = atoi(argv[5]);
+            GRIDY = atoi(argv[6]);
+        }
+        if (logging && (uint64_t)GRIDX * GRIDY > STAT_MAX_CELLS) {
+            cerr << "--stats keeps a heatmap per match, " << GRIDX << "x" << GRIDY << " is past "
+                 << STAT_MAX_CELLS << " cells" << endl;
+            return 1;
+        }
+        host_t host(atoi(argv[2]), atoi(argv[3]), GRIDX, GRIDY, logging ? &sink : nullptr);
+        host.run(atoi(argv[4]));
+        host.report();
+        if (logging) {
+            heatmap_t heat = sink.totals();
+            cout << argv[argc - 1] << ": " << sink.bytes() << " bytes, " << heat.total(STAT_POS) << " positions, "
+                 << heat.total(STAT_STORM_DEATH) + heat.total(STAT_SHORT_DEATH) + heat.total(STAT_LONG_DEATH) << " deaths" << endl;
+        }
+        return 0;
+    }
+    // storm consistency check: --check
+    if (argc == 2 && string(argv[1]) == "--check") return stormCheck();
+    // training environment throughput: --env <matches> <threads> <steps> [x y]
+    if (argc >= 5 && string(argv[1]) == "--env") {
+        if (argc == 7) {
+            GRIDX = atoi(argv[5]);
+            GRIDY = atoi(argv[6]);
+        }
+        return benchEnv(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), GRIDX, GRIDY);
+    }
+    // heatmaps from any number of stat files: --heatmap <file>...
+    if (argc >= 3 && string(argv[1]) == "--heatmap") {
+        heatmap_t heat;
+        for (int i = 2; i < argc; i++)
+            if (readStats(argv[i], heat) != 0) return 1;
+        heat.print(cout);
+        return 0;
+    }
+
+    // map tools: --convert <layout.txt> <arena.map>, then play it with --map <arena.map>
+    if (argc == 4 && string(argv[1]) == "--convert") return convertMap(argv[2], argv[3]);
+    mapfile_t layout;
+    if (argc == 3 && string(argv[1]) == "--map" && !layout.open(argv[2])) {
+        cerr << argv[2] << " is not a map file" << endl;
+        return 1;
+    }
+
     // pre-game initialization ---------------------------------------------
     initCurses();
-    int round = 0;
-    bool haveShortWep = false;              // don't have short
-    bool haveLongWep = false;               // or long weapon initially
-    int pU = 0; int pL = 0; int pR = 0; int pD = 0;
 
     // changes size of map to custom value
-    if (argc == 3) {
+    if (argc == 3 && layout.header == nullptr) {
         GRIDX = atoi(argv[1]);
         GRIDY = atoi(argv[2]);
     }
 
-    srand(time(NULL));                      // creates random seed rand() function
-
-    map_t map(GRIDY, GRIDX);                // generating map and random center coord
-    player_t p[PLAYERCNT];                  // 25 player objects
-    obstacle_t o[NUM_OF_OBSTACLES];
-    trigger_t shortWep[NUM_SHORT_WEPS];
-    trigger_t longWep[NUM_LONG_WEPS];
-    for (int i = 0; i < NUM_LONG_WEPS; i++)
-        longWep[i].setSymbol('!');          // setting the long rage weapon symbol
-
-    for (int i = 0; i < NUM_OF_OBSTACLES; i++) {
-        o[i].pos.randomize();               // randomize the obstacles
-        map.dynAddEnt(&(o[i]), o[i].pos);   // add them to the map
-    }
-    // initializing game arrays---------------------------------------------
-    for (int i = 0; i < PLAYERCNT; i++) {
-        p[i].pos.randomize();               // sets player to random position
-        map.dynAddEnt(&(p[i]), p[i].pos);
-    }
-    for (int i = 0; i<NUM_SHORT_WEPS; i++){
-        shortWep[i].pos.randomize();
-        map.dynAddEnt(&(shortWep[i]), shortWep[i].pos);
-    }
-    for (int i = 0; i<NUM_LONG_WEPS; i++){
-        longWep[i].pos.randomize();
-        map.dynAddEnt(&(longWep[i]), longWep[i].pos);
-    }
+    // map, 25 players, obstacles and weapons all live in the match
+    unique_ptr<match_t> game(layout.header ? new match_t(layout, time(NULL)) : new match_t(GRIDX, GRIDY, time(NULL)));
+    layout.close();                         // the match copied out everything it needs
+    game->workers = std::max(1u, thread::hardware_concurrency());   // big maps storm in parallel
+#ifdef __cpp_impl_coroutine
+    game->scriptPlayers(1, PLAYERCNT);      // everyone but you, they act while the storm rounds tick by
+#endif
+    map_t &map = game->map;
+    player_t *p = game->p;
+    fov_t &fov = game->fov;                 // fog of war for p[0], shared visibility for everyone
+    map.viewer = 0;
+    minimap_t mini;                         // only drawn when the map is bigger than the terminal
+    mini.init(&map);
+    map.minimap = &mini;
+    rewind_t history(REWIND_TICKS);         // what 'b' undoes
+    history.start(&map, &game->world, game->tickNo, game->round);
+    eventbus_t events(EVENT_QUEUE);         // the match's news, the feed line reads it on its own thread
+    killfeed_t feed;
+    events.subscribe(&feed);
+    events.start();
+    game->events = &events;
     
     // main game loop start ------------------------------------------------
-    char input = ' ';
+    vector<int> pending;                    // every key typed since the last frame
+    bool quit = false;
+    inputring_t keys;                       // filled by the input thread, drained here
+    atomic<bool> stopInput(false);
+    thread reader(readInput, STDIN_FILENO, ref(keys), ref(stopInput));
+    long long worstLatency = 0;             // longest a key waited in the ring, ns
+
+    framebuffer_t frames;                   // the simulation never waits on the terminal
+    atomic<bool> stopRender(false);
+    string hint;                            // extra line under the grid, cleared after it's shown
+    bool won = false;
+
+    // builds and hands over the next frame, the renderer picks it up whenever it's ready
+    auto publish = [&]() {
+        frame_t& f = frames.back();
+        char buf[128];
+        snprintf(buf, sizeof(buf), "Center: (%i, %i)\n", map.centerCoord.x, map.centerCoord.y);
+        f.top = buf;
+        f.top += "Victor's Battle Royale!\n";
+        f.top += "Use wasd to move, q to quit - # is the short range weapon ! is the long range\n";
+        // the camera: as much of the map as the terminal holds, centered on p[0] where it can be,
+        // with the minimap to its right once the map doesn't fit
+        struct winsize ws;
+        int termCols = 80, termRows = 24;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0) {
+            termCols = ws.ws_col;
+            termRows = ws.ws_row;
+        }
+        f.rows = std::max(1, std::min(map.rows, termRows - VIEW_TEXT_LINES));
+        f.cols = std::max(1, std::min(map.cols, termCols - 1));
+        f.miniCols = 0;
+        if (f.rows < map.rows || f.cols < map.cols) {
+            f.miniCols = std::min(MINI_COLS, termCols / 4);
+            f.cols = std::max(1, std::min(map.cols, termCols - 1 - f.miniCols - 3));
+        }
+        int x0 = std::max(0, std::min(map.cols - f.cols, p[0].pos().x - f.cols / 2));
+        int y0 = std::max(0, std::min(map.rows - f.rows, p[0].pos().y - f.rows / 2));
+        map.snapshot(f.cells, x0, y0, f.cols, f.rows);
+        if (f.miniCols > 0) {
+            bool alive = p[0].playerStatus[0] == ALIVE;
+            mini.draw(f.mini, f.miniCols, std::min(MINI_ROWS, f.rows), alive ? p[0].pos().x : -1, alive ? p[0].pos().y : -1, !alive);
+            f.mini.resize(f.miniCols * f.rows, ' ');
+        }
+        f.bottom.clear();
+        if (game->round > 0) {
+            snprintf(buf, sizeof(buf), "Round %i Complete. Press Enter to Continue\n", game->round);
+            f.bottom += buf;
+        }
+        snprintf(buf, sizeof(buf), "Input queue: %i waiting, high water %i/%u, slowest key %.1f ms\n",
+                 keys.fill(), keys.highWater(), inputring_t::CAPACITY, worstLatency / 1e6);
+        f.bottom += buf;
+        f.bottom += feed.latest();
+        f.bottom += hint;
+        frames.publish();
+    };
 
     // //printing game info
-    printw("Center: (%i, %i)\n", map.centerCoord.x, map.centerCoord.y);
-    printw("Victor's Battle Royale!\n");
-    printw("Use wasd to move, q to quit - # is the short range weapon ! is the long range\n");
-    map.dynamicPrint();
+    publish();
+    thread renderer(renderFrames, ref(frames), ref(stopRender));
     
     // main game loop, terminated by press of 'q'
-    while (input != 'q') {
-        input = getch();
-        p[0].chooseLastAlive();
+    // one frame = everything typed since the last one, run as a batch, then one victory check and redraw
+    while (!quit && !won) {
+        pending.clear();
+        keypress_t k;
+        while (!keys.pop(k)) this_thread::sleep_for(chrono::milliseconds(INPUT_POLL_MS));  // tick boundary
+        long long now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        do {                                // then takes whatever else is already typed or pasted
+            pending.push_back(k.key);
+            worstLatency = std::max(worstLatency, now - k.at);
+        } while (keys.pop(k));
+
+        p[0].chooseLastAlive(game->rng);
         int lastAlive = p[0].lastAlive;
-        // only move if player is alive
-        if (p[0].playerStatus[0] == ALIVE) {
-            makemove(map, p[0], o, shortWep, longWep, input, haveShortWep, haveLongWep);     // updates map and player obj based on usr input
-        }
-
-        if (input == '\n') {
-            map.clearScreen();
-            printw("Center: (%i, %i)\n", map.centerCoord.x, map.centerCoord.y);
-            printw("Victor's Battle Royale!\n");
-            printw("Use wasd to move, q to quit - # is the short range weapon ! is the long range\n");
-            
-            update(map, &map, p, pU, pR, pD, pL);
-            
-            map.dynamicPrint();
-            
-            // updates status of all players (either dead or alive) after the map gets updated with new storm iteration
-            for (int i = 0; i < PLAYERCNT; i++){
-                p[i].updateStatus(map);
-                // printw("%i ", p[0].playerStatus[i]);
+        bool unknown = false;
+        for (size_t i = 0; i < pending.size() && !quit; i++) {
+            switch (KEY_ACTIONS[pending[i]]) {
+            case KEY_PLAY:                  // updates map and player obj based on usr input, if p[0] is alive
+                game->command(0, pending[i]);
+                game->step();               // each key is its own tick: shots fly, cooldowns and reloads run down
+                break;
+            case KEY_REWIND:
+                game->rewind(1);
+                break;
+            case KEY_ROUND:                 // enter skips ahead to the end of the storm round
+                game->advanceRound();
+                break;
+            case KEY_QUIT:                  // ensures immediate termination, the rest of the batch is dropped
+                quit = true;
+                break;
+            default:
+                unknown = true;
             }
-            printw("Round %i Complete. Press Enter to Continue\n", (round+1));
-            // only increments round if user presses enter
-            round++;
-        // ensures immediate termination rather than waiting for loop to end
-        } else if (input == 'q'){
-            break;
-        // user input validation
-        } else if ( input != 'w' && input != 'd' && input != 'a' && 
-                    input != 's' && input != 'f' && input != 'u' &&
-                    input != 'k' && input != 'j' && input != 'h'){
-            printw("Error! Only Press Enter.\n");
-            break;
         }
+        game->threat.sync();
+        fov.refresh();                      // only recasts octants touched by this frame's moves
+        map.viewer = p[0].playerStatus[0] == DEAD ? -1 : 0; // spectators see the whole map, until a rewind
+
+        // user input validation, anything else is just skipped
+        hint = unknown ? "Only wasd, f, uhjk, r, b, enter and q do anything.\n" : "";
         // checking for victory status
-        if (checkVictor(p, map, lastAlive)){
-            endCurses();
-            return 0;
-        };  
+        if (!quit) won = checkVictor(p, map, lastAlive, hint);
+        publish();
     } 
+    stopInput = true;
+    reader.join();
+    stopRender = true;
+    renderer.join();                        // after this the main thread owns curses again, for endCurses()
+    game->events = nullptr;
+    events.stop();
     // end main game loop ----------------------------------------------------
 
     endCurses();
     return 0;
 }
-
+#endif